@@ -0,0 +1,91 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "../linesplitter.h"
+
+/**
+ * Compare the `LineSplitter` against the byte-by-byte splitting that `NixQueueCmd::flush_stderr()` used to
+ * do, on the kind of STDERR that a chatty, progress-reporting script produces.  The data is appended in
+ * chunks of the size that `NixQueueCmd::run_cmd()` `read()`s, and split after every chunk.
+ *
+ * Note that the byte-by-byte splitter finds slightly fewer (and shorter) lines, because it forgot the start
+ * of any line that was split over two `read()`s.
+ */
+
+const size_t CHUNK_SIZE = 512;
+
+struct ByteByByteSplitter
+{
+    std::string::size_type pos = 0;
+
+    template <typename F>
+    void feed(const std::string &buf, F on_line)
+    {
+        std::string_view v = std::string_view(buf).substr(pos, buf.size());
+        std::string line;
+        for (char c : v)
+        {
+            if (c == '\n' || c == '\r')
+            {
+                if (!line.empty())
+                    on_line(std::string_view(line));
+                line.clear();
+            }
+            else
+            {
+                line.push_back(c);
+            }
+            pos++;
+        }
+    }
+};
+
+std::string make_stderr(size_t total_size)
+{
+    std::string out;
+    out.reserve(total_size + 128);
+    for (int i = 0; out.size() < total_size; i++)
+    {
+        out += "Progress: " + std::to_string(i % 100) + "% of batch " + std::to_string(i / 100) + '\r';
+        if (i % 100 == 99)
+            out += "Finished batch " + std::to_string(i / 100) + " without any problems worth mentioning\n";
+    }
+    return out;
+}
+
+template <typename Splitter>
+void bench(const char *name, const std::string &input)
+{
+    Splitter splitter;
+    std::string buf;
+    size_t lines = 0;
+    size_t line_bytes = 0;
+    auto on_line = [&](std::string_view line) { lines++; line_bytes += line.size(); };
+
+    buf.reserve(input.size());
+
+    // Only the splitting is timed, not the growing of the buffer.
+    std::chrono::steady_clock::duration elapsed{};
+    for (size_t i = 0; i < input.size(); i += CHUNK_SIZE)
+    {
+        buf.append(input, i, CHUNK_SIZE);
+        auto start = std::chrono::steady_clock::now();
+        splitter.feed(buf, on_line);
+        elapsed += std::chrono::steady_clock::now() - start;
+    }
+
+    double secs = std::chrono::duration<double>(elapsed).count();
+    std::cout << name << ": " << lines << " lines (" << line_bytes << " bytes) in " << secs * 1000 << " ms; "
+              << (input.size() / secs / (1024 * 1024)) << " MiB/s" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    size_t total_size = (argc > 1 ? std::stoul(argv[1]) : 64) * 1024 * 1024;
+    const std::string input = make_stderr(total_size);
+
+    bench<ByteByByteSplitter>("byte-by-byte", input);
+    bench<LineSplitter>("LineSplitter", input);
+}
@@ -0,0 +1,134 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <string>
+#include <string_view>
+
+#include "../pq-raii/libpq-raii.hpp"
+
+/**
+ * Compare the vectorized scanning and hex coding in `PQ::simd` against their byte-by-byte (`…_scalar()`)
+ * counterparts and against what the literal parsers and escapers used before: `std::regex_replace()` for
+ * `PQ::double_quote()` and `PQunescapeBytea()` for `PQ::from_text_bytea()`.  Also time the parsing of a big
+ * `cmd_env` `hstore`.
+ *
+ * Which vector instructions are used depends on the flags that this is compiled with; build with
+ * `-DCMAKE_CXX_FLAGS=-mavx2` to get the AVX2 rather than the SSE2 code paths.
+ */
+
+const int ROUNDS = 20;
+
+template <typename F>
+void bench(const char *name, size_t bytes_per_round, F f)
+{
+    size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUNDS; i++)
+        sink += f();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << ": " << secs * 1000 / ROUNDS << " ms per round; "
+              << (bytes_per_round * ROUNDS / secs / (1024 * 1024)) << " MiB/s (" << sink % 10 << ")" << std::endl;
+}
+
+std::string make_bytes(size_t size)
+{
+    std::mt19937 rng(1);
+    std::string bytes(size, '\0');
+    for (char &c : bytes)
+        c = rng();
+    return bytes;
+}
+
+/**
+ * Text with a `"` or `\` every few hundred bytes, like the shell snippets and paths in a typical `cmd_env`.
+ */
+std::string make_text(size_t size)
+{
+    std::string text;
+    text.reserve(size + 128);
+    for (int i = 0; text.size() < size; i++)
+        text += "PATH_COMPONENT_" + std::to_string(i) + "=/usr/local/lib/some/thing/or/other:"
+                + (i % 4 == 0 ? "\"quoted\" " : "") + (i % 7 == 0 ? "back\\slash " : "");
+    return text;
+}
+
+std::string regex_double_quote(const std::string &unquoted)
+{
+    static std::regex re("\"|\\\\");
+
+    return std::string("\"") + std::regex_replace(unquoted, re, "\\$&") + "\"";
+}
+
+int main(int argc, char **argv)
+{
+    const size_t size = (argc > 1 ? std::stoul(argv[1]) : 16) * 1024 * 1024;
+
+    const std::string bytes = make_bytes(size);
+    std::string hex(2 * size, '\0');
+    const auto *in = reinterpret_cast<const unsigned char *>(bytes.data());
+
+    bench("encode_hex_scalar", size, [&]() {
+        PQ::simd::encode_hex_scalar(in, size, hex.data());
+        return size_t(hex[size]);
+    });
+    bench("encode_hex", size, [&]() {
+        PQ::simd::encode_hex(in, size, hex.data());
+        return size_t(hex[size]);
+    });
+
+    std::string decoded(size, '\0');
+    auto *out = reinterpret_cast<unsigned char *>(decoded.data());
+    bench("decode_hex_scalar", size, [&]() {
+        return size_t(PQ::simd::decode_hex_scalar(hex.data(), size, out));
+    });
+    bench("decode_hex", size, [&]() {
+        return size_t(PQ::simd::decode_hex(hex.data(), size, out));
+    });
+
+    const std::string hex_bytea = PQ::as_hex_bytea(bytes);
+    bench("PQunescapeBytea", size, [&]() {
+        size_t len = 0;
+        unsigned char *unescaped = PQunescapeBytea(reinterpret_cast<const unsigned char *>(hex_bytea.c_str()), &len);
+        PQfreemem(unescaped);
+        return len;
+    });
+    bench("from_text_bytea", size, [&]() {
+        return PQ::from_text_bytea(hex_bytea).size();
+    });
+
+    const std::string text = make_text(size);
+    const char *const text_end = text.data() + text.size();
+    bench("find_any_scalar", size, [&]() {
+        size_t n = 0;
+        for (const char *p = text.data(); (p = PQ::simd::find_any_scalar<'"', '\\'>(p, text_end)) != text_end; p++)
+            n++;
+        return n;
+    });
+    bench("find_any", size, [&]() {
+        size_t n = 0;
+        for (const char *p = text.data(); (p = PQ::simd::find_any<'"', '\\'>(p, text_end)) != text_end; p++)
+            n++;
+        return n;
+    });
+
+    bench("regex_double_quote", size, [&]() {
+        return regex_double_quote(text).size();
+    });
+    bench("double_quote", size, [&]() {
+        return PQ::double_quote(text).size();
+    });
+
+    // A `cmd_env` with lots of big values, as it comes out of Postgres.
+    std::unordered_map<std::string, std::string> env;
+    for (size_t i = 0, env_size = 0; env_size < size; i++)
+    {
+        std::string value = text.substr((i * 4099) % (text.size() - 4096), 4096);
+        env_size += value.size();
+        env["VAR_" + std::to_string(i)] = std::move(value);
+    }
+    const std::string hstore = PQ::as_text_hstore(env);
+    bench("from_text_hstore", hstore.size(), [&]() {
+        return PQ::from_text_hstore(hstore).size();
+    });
+}
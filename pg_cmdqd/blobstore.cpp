@@ -0,0 +1,108 @@
+#include "blobstore.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <vector>
+
+#include <openssl/evp.h>
+
+#include "utils.h"
+
+BlobStore::BlobStore(const std::string &dir)
+    : _dir(dir)
+{
+}
+
+BlobStore::Ref BlobStore::store(std::string_view data) const
+{
+    const std::string hash = sha256_hex(data);
+    const std::string subdir = _dir + "/" + hash.substr(0, 2);
+    const std::string path = subdir + "/" + hash;
+
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 and static_cast<size_t>(st.st_size) == data.size())
+        return {hash, data.size(), path};
+
+    if (mkdir(subdir.c_str(), 0755) < 0 and errno != EEXIST)
+        throw std::runtime_error(formatString("mkdir(\"%s\") failed: %s", subdir.c_str(), strerror(errno)));
+
+    std::string tmp_path = subdir + "/.tmp-" + hash.substr(0, 8) + "-XXXXXX";
+    std::vector<char> tmp_path_buf(tmp_path.begin(), tmp_path.end());
+    tmp_path_buf.push_back('\0');
+    const int fd = mkstemp(tmp_path_buf.data());
+    if (fd < 0)
+        throw std::runtime_error(formatString("mkstemp(\"%s\") failed: %s", tmp_path.c_str(), strerror(errno)));
+    tmp_path = tmp_path_buf.data();
+
+    auto fail = [&](const char *what) {
+        const int saved_errno = errno;
+        close(fd);
+        unlink(tmp_path.c_str());
+        throw std::runtime_error(formatString("%s on \"%s\" failed: %s", what, tmp_path.c_str(), strerror(saved_errno)));
+    };
+
+    size_t written = 0;
+    while (written < data.size())
+    {
+        const ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            fail("write()");
+        }
+        written += n;
+    }
+
+    // The files are meant to be read by the Postgres server as well, which may well run as another user.
+    if (fchmod(fd, 0644) < 0)
+        fail("fchmod()");
+    if (fsync(fd) < 0)
+        fail("fsync()");
+    if (close(fd) < 0)
+    {
+        unlink(tmp_path.c_str());
+        throw std::runtime_error(formatString("close() on \"%s\" failed: %s", tmp_path.c_str(), strerror(errno)));
+    }
+
+    if (rename(tmp_path.c_str(), path.c_str()) < 0)
+    {
+        const int saved_errno = errno;
+        unlink(tmp_path.c_str());
+        throw std::runtime_error(formatString(
+            "rename(\"%s\", \"%s\") failed: %s", tmp_path.c_str(), path.c_str(), strerror(saved_errno)));
+    }
+
+    // Make the rename itself durable, before the path ends up in the database.
+    const int dir_fd = open(subdir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    return {hash, data.size(), path};
+}
+
+std::string BlobStore::sha256_hex(std::string_view data)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    if (EVP_Digest(data.data(), data.size(), digest, &digest_len, EVP_sha256(), nullptr) != 1)
+        throw std::runtime_error("EVP_Digest() failed to compute SHA-256 hash.");
+
+    static const char hex_digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(digest_len * 2);
+    for (unsigned int i = 0; i < digest_len; i++)
+    {
+        hex.push_back(hex_digits[digest[i] >> 4]);
+        hex.push_back(hex_digits[digest[i] & 0xF]);
+    }
+    return hex;
+}
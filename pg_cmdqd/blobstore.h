@@ -0,0 +1,38 @@
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <stddef.h>
+
+#include <string>
+#include <string_view>
+
+/**
+ * A directory in which command output is stored by its SHA-256 hash, in `<dir>/<first 2 hex digits>/<hash>`
+ * files, like Git stores its objects.
+ *
+ * Identical output is thus only stored once.  Files are written to a temporary file that is only renamed to
+ * its final name once it's complete and `fsync()`ed, so that a file under its final name is never partial.
+ */
+class BlobStore
+{
+    std::string _dir;
+
+public:
+    struct Ref
+    {
+        std::string sha256_hex;
+        size_t size;
+        std::string path;
+    };
+
+    BlobStore(const std::string &dir);
+
+    /**
+     * Store `data`, unless it's already there, and return where it is; throws a `std::runtime_error` on failure.
+     */
+    Ref store(std::string_view data) const;
+
+    static std::string sha256_hex(std::string_view data);
+};
+
+#endif // BLOBSTORE_H
@@ -0,0 +1,81 @@
+#include "boundedoutput.h"
+
+#include <algorithm>
+
+#include "utils.h"
+
+BoundedOutput::BoundedOutput(std::optional<size_t> max_bytes)
+    : _max_bytes(max_bytes)
+{
+}
+
+size_t BoundedOutput::head_bytes() const
+{
+    return _max_bytes.value() / 2;
+}
+
+size_t BoundedOutput::tail_bytes() const
+{
+    return _max_bytes.value() - head_bytes();
+}
+
+void BoundedOutput::append(std::string &buf, const char *data, size_t len)
+{
+    _total_bytes += len;
+
+    if (not _max_bytes)
+    {
+        buf.append(data, len);
+        return;
+    }
+
+    if (buf.size() < head_bytes())
+    {
+        const size_t head_len = std::min(len, head_bytes() - buf.size());
+        buf.append(data, head_len);
+        data += head_len;
+        len -= head_len;
+    }
+
+    const size_t tail_len = tail_bytes();
+    if (len >= tail_len)
+    {
+        _tail.assign(data + len - tail_len, tail_len);
+    }
+    else
+    {
+        _tail.append(data, len);
+
+        // Only trim the tail once it has grown to twice its size, so that we don't shift it for every read.
+        if (_tail.size() > 2 * tail_len)
+            _tail.erase(0, _tail.size() - tail_len);
+    }
+}
+
+void BoundedOutput::finish(std::string &buf)
+{
+    if (_tail.empty())
+        return;
+
+    if (truncated())
+    {
+        if (_tail.size() > tail_bytes())
+            _tail.erase(0, _tail.size() - tail_bytes());
+
+        const size_t omitted_bytes = _total_bytes - head_bytes() - _tail.size();
+        buf += formatString("\n[… %zu bytes truncated by pg_cmdqd …]\n", omitted_bytes);
+    }
+
+    buf += _tail;
+    _tail.clear();
+}
+
+size_t BoundedOutput::total_bytes() const
+{
+    return _total_bytes;
+}
+
+bool BoundedOutput::truncated() const
+{
+    return _max_bytes and _total_bytes > _max_bytes.value();
+}
@@ -0,0 +1,43 @@
+#ifndef BOUNDEDOUTPUT_H
+#define BOUNDEDOUTPUT_H
+
+#include <stddef.h>
+
+#include <optional>
+#include <string>
+
+/**
+ * Caps how much of a command's output (`cmd_stdout` or `cmd_stderr`) is kept in memory.
+ *
+ * As long as the output fits within `max_bytes`, it is appended to the buffer as-is.  Beyond that, only the
+ * first half of `max_bytes` (the head) stays in the buffer, and of the rest only the last bytes (the tail)
+ * are remembered.  `finish()` then appends a truncation marker and the tail to the buffer.  Until then, the
+ * buffer is only ever appended to, so that a `LineSplitter` can keep following it.
+ *
+ * The output is still counted in full, so that the caller can keep draining the command's pipes and can
+ * record how many bytes the command actually wrote.
+ */
+class BoundedOutput
+{
+    std::optional<size_t> _max_bytes;
+    size_t _total_bytes = 0;
+    std::string _tail;
+
+    size_t head_bytes() const;
+    size_t tail_bytes() const;
+
+public:
+    BoundedOutput(std::optional<size_t> max_bytes = std::nullopt);
+
+    void append(std::string &buf, const char *data, size_t len);
+
+    /**
+     * Append the truncation marker and the tail to `buf`, if anything had to be left out.
+     */
+    void finish(std::string &buf);
+
+    size_t total_bytes() const;
+    bool truncated() const;
+};
+
+#endif // BOUNDEDOUTPUT_H
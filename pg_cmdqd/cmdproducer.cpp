@@ -0,0 +1,295 @@
+#include "cmdproducer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+static const uint32_t TEXTOID = 25;
+
+// Flush the `COPY` data to the connection once it has grown this big.
+static const size_t PUT_THRESHOLD_BYTES = 64 * 1024;
+
+static void append_int16(std::string &out, int16_t n)
+{
+    const uint16_t u = n;
+    const char bytes[] = {char(u >> 8), char(u)};
+    out.append(bytes, sizeof(bytes));
+}
+
+static void append_int32(std::string &out, int32_t n)
+{
+    const uint32_t u = n;
+    const char bytes[] = {char(u >> 24), char(u >> 16), char(u >> 8), char(u)};
+    out.append(bytes, sizeof(bytes));
+}
+
+static void append_value(std::string &out, std::string_view value)
+{
+    if (value.size() > INT32_MAX)
+        throw std::length_error("Value too long for the binary `COPY` format.");
+    append_int32(out, value.size());
+    out.append(value);
+}
+
+static void append_nullable_value(std::string &out, const std::optional<std::string> &value)
+{
+    if (value)
+        append_value(out, value.value());
+    else
+        append_int32(out, -1);
+}
+
+/**
+ * The binary `COPY` format has a length in front of each field, which we only know after encoding the array
+ * or `hstore` field.  `begin_field()` leaves room for it; `end_field()` fills it in.
+ */
+static size_t begin_field(std::string &out)
+{
+    append_int32(out, 0);
+    return out.size();
+}
+
+static void end_field(std::string &out, size_t field_start)
+{
+    std::string length;
+    append_int32(length, out.size() - field_start);
+    out.replace(field_start - 4, 4, length);
+}
+
+/**
+ * A one-dimensional `text[]`, as written by `array_send()`.
+ */
+template <typename Elements, typename AppendElement>
+static void append_text_array(std::string &out, const Elements &elements, bool has_nulls, AppendElement append_element)
+{
+    const size_t field_start = begin_field(out);
+    append_int32(out, elements.empty() ? 0 : 1);  // `ndim`; an empty array has no dimensions at all.
+    append_int32(out, has_nulls);
+    append_int32(out, TEXTOID);
+    if (not elements.empty())
+    {
+        append_int32(out, elements.size());
+        append_int32(out, 1);  // The lower bound.
+    }
+    for (const auto &element : elements)
+        append_element(out, element);
+    end_field(out, field_start);
+}
+
+CmdProducer::CmdProducer(const std::shared_ptr<PG::conn> &conn, const std::string &cmd_class, size_t batch_size)
+    : _conn(conn), _batch_size(batch_size > 0 ? batch_size : 1)
+{
+    PG::result result = PQ::execParams(conn, std::string(R"SQL(
+SELECT
+    q.cmd_class::oid
+    ,q.cmd_class::text
+    ,q.cmd_signature_class = 'cmdq.sql_queue_cmd_template'::regclass
+FROM
+    cmdq.cmd_queue AS q
+WHERE
+    q.cmd_class = $1::regclass
+)SQL"), 1, {}, {cmd_class});
+    if (PQ::resultStatus(result) != PGRES_TUPLES_OK)
+        throw std::runtime_error("Could not look up the command queue: " + PQ::resultErrorMessage(result));
+    if (PQ::ntuples(result) != 1)
+        throw std::runtime_error("There is no command queue for `" + cmd_class + "` in `cmdq.cmd_queue`.");
+
+    _cmd_class_oid = std::stoul(PQ::getvalue(result, 0, 0));
+    _cmd_class = PQ::getvalue(result, 0, 1);
+    _kind = PQ::getvalue(result, 0, 2) == "t" ? Kind::SQL : Kind::NIX;
+}
+
+CmdProducer::~CmdProducer()
+{
+    if (_in_batch)
+        abort_batch("The `CmdProducer` was destroyed before its last batch was flushed.");
+}
+
+CmdProducer::Kind CmdProducer::kind() const
+{
+    return _kind;
+}
+
+size_t CmdProducer::cmds_enqueued() const
+{
+    return _cmds_enqueued;
+}
+
+void CmdProducer::exec_or_throw(const std::string &sql, ExecStatusType expected_status)
+{
+    PG::result result = PQ::exec(_conn, sql);
+    if (PQ::resultStatus(result) != expected_status)
+        throw std::runtime_error(sql + " failed: " + PQ::resultErrorMessage(result));
+}
+
+void CmdProducer::begin_batch()
+{
+    exec_or_throw("BEGIN TRANSACTION", PGRES_COMMAND_OK);
+    _in_batch = true;
+    try
+    {
+        // Makes a `queue_cmd__notify()` trigger send the same payload for every command, which Postgres
+        // delivers only once, after the `COMMIT`.
+        exec_or_throw("SET LOCAL pg_cmd_queue.coalesce_notify TO on", PGRES_COMMAND_OK);
+
+        exec_or_throw(
+            "COPY " + _cmd_class + (_kind == Kind::NIX
+                ? " (cmd_class, cmd_id, cmd_subid, cmd_argv, cmd_env, cmd_stdin)"
+                : " (cmd_class, cmd_id, cmd_subid, cmd_sql, cmd_sql_params)")
+            + " FROM STDIN (FORMAT binary)",
+            PGRES_COPY_IN);
+    }
+    catch (const std::runtime_error &)
+    {
+        PQ::exec(_conn, "ROLLBACK TRANSACTION");
+        _in_batch = false;
+        throw;
+    }
+
+    // The signature, the flags field and the length of the header extension area.
+    _buffer.assign("PGCOPY\n\377\r\n\0", 11);
+    append_int32(_buffer, 0);
+    append_int32(_buffer, 0);
+}
+
+void CmdProducer::append_row(const std::string &cmd_id, const std::optional<std::string> &cmd_subid,
+                             int16_t field_count, const std::function<void(std::string &out)> &append_fields)
+{
+    if (not _in_batch)
+        begin_batch();
+
+    // A value that's too long for the `COPY` format may only turn up halfway through the row, which must then not
+    // be left behind in front of the next row.
+    const size_t row_start = _buffer.size();
+    try
+    {
+        append_int16(_buffer, field_count);
+        append_int32(_buffer, sizeof(_cmd_class_oid));
+        append_int32(_buffer, _cmd_class_oid);
+        append_value(_buffer, cmd_id);
+        append_nullable_value(_buffer, cmd_subid);
+        append_fields(_buffer);
+    }
+    catch (...)
+    {
+        _buffer.resize(row_start);
+        throw;
+    }
+
+    if (_buffer.size() >= PUT_THRESHOLD_BYTES)
+        put_buffer();
+
+    if (++_batch_cmds >= _batch_size)
+        flush();
+}
+
+void CmdProducer::put_buffer()
+{
+    if (PQputCopyData(_conn->get(), _buffer.data(), _buffer.size()) != 1)
+    {
+        const std::string error = PQ::errorMessage(_conn);
+        abort_batch(error);
+        throw std::runtime_error("Sending `COPY` data failed: " + error);
+    }
+    _buffer.clear();
+}
+
+void CmdProducer::abort_batch(const std::string &reason)
+{
+    PQputCopyEnd(_conn->get(), reason.c_str());
+    for (PG::result result = PQ::getResult(_conn); result.get(); result = PQ::getResult(_conn))
+        ;
+    PQ::exec(_conn, "ROLLBACK TRANSACTION");
+
+    _in_batch = false;
+    _batch_cmds = 0;
+    _buffer.clear();
+}
+
+void CmdProducer::enqueue_nix_cmd(const std::string &cmd_id,
+                                  const std::optional<std::string> &cmd_subid,
+                                  const std::vector<std::string> &cmd_argv,
+                                  const std::unordered_map<std::string, std::optional<std::string>> &cmd_env,
+                                  std::string_view cmd_stdin)
+{
+    if (_kind != Kind::NIX)
+        throw std::invalid_argument("`" + _cmd_class + "` is not a `nix_queue_cmd_template`-derived queue.");
+
+    append_row(cmd_id, cmd_subid, 6, [&](std::string &out) {
+        append_text_array(out, cmd_argv, false, [](std::string &out, const std::string &arg) {
+            append_value(out, arg);
+        });
+
+        // As written by `hstore_send()`.
+        const size_t cmd_env_start = begin_field(out);
+        append_int32(out, cmd_env.size());
+        for (const auto &[key, value] : cmd_env)
+        {
+            append_value(out, key);
+            append_nullable_value(out, value);
+        }
+        end_field(out, cmd_env_start);
+
+        append_value(out, cmd_stdin);
+    });
+}
+
+void CmdProducer::enqueue_sql_cmd(const std::string &cmd_id,
+                                  const std::optional<std::string> &cmd_subid,
+                                  const std::string &cmd_sql,
+                                  const std::optional<std::vector<std::optional<std::string>>> &cmd_sql_params)
+{
+    if (_kind != Kind::SQL)
+        throw std::invalid_argument("`" + _cmd_class + "` is not a `sql_queue_cmd_template`-derived queue.");
+
+    append_row(cmd_id, cmd_subid, 5, [&](std::string &out) {
+        append_value(out, cmd_sql);
+
+        if (cmd_sql_params)
+        {
+            const std::vector<std::optional<std::string>> &params = cmd_sql_params.value();
+            const bool has_nulls = std::find(params.begin(), params.end(), std::nullopt) != params.end();
+            append_text_array(out, params, has_nulls, [](std::string &out, const std::optional<std::string> &param) {
+                append_nullable_value(out, param);
+            });
+        }
+        else
+            append_int32(out, -1);
+    });
+}
+
+void CmdProducer::flush()
+{
+    if (not _in_batch)
+        return;
+
+    append_int16(_buffer, -1);  // The file trailer.
+    put_buffer();
+
+    if (PQputCopyEnd(_conn->get(), nullptr) != 1)
+    {
+        const std::string error = PQ::errorMessage(_conn);
+        abort_batch(error);
+        throw std::runtime_error("Ending the `COPY` failed: " + error);
+    }
+
+    // Only now do we find out whether any of the commands in the batch were rejected.
+    std::string copy_error;
+    for (PG::result result = PQ::getResult(_conn); result.get(); result = PQ::getResult(_conn))
+    {
+        if (PQ::resultStatus(result) != PGRES_COMMAND_OK and copy_error.empty())
+            copy_error = PQ::resultErrorMessage(result);
+    }
+
+    _in_batch = false;
+    const size_t batch_cmds = _batch_cmds;
+    _batch_cmds = 0;
+
+    if (not copy_error.empty())
+    {
+        PQ::exec(_conn, "ROLLBACK TRANSACTION");
+        throw std::runtime_error("`COPY` failed: " + copy_error);
+    }
+
+    exec_or_throw("COMMIT TRANSACTION", PGRES_COMMAND_OK);
+    _cmds_enqueued += batch_cmds;
+}
@@ -0,0 +1,87 @@
+#ifndef CMDPRODUCER_H
+#define CMDPRODUCER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "pq-raii/libpq-raii.hpp"
+
+/**
+ * Enqueues commands in bulk, by `COPY`ing them (in binary format) into a `nix_queue_cmd_template`- or
+ * `sql_queue_cmd_template`-derived table, rather than `INSERT`ing them one by one.
+ *
+ * Every batch of `batch_size` commands is `COPY`ed and committed in a transaction of its own, with
+ * `pg_cmd_queue.coalesce_notify` on, so that a `queue_cmd__notify()` trigger on the table wakes up the
+ * daemon with one `NOTIFY` per batch, instead of with one per command.
+ *
+ * Errors (including those of the `COPY`, which only surface once a batch is done) are thrown as
+ * `std::runtime_error`s, after which the batch that was being `COPY`ed has been rolled back.  A command with a
+ * value too long for the binary `COPY` format is refused with a `std::length_error`, and leaves the batch as
+ * it was.  Call `flush()` after the last command; the destructor rolls back a batch that has not been flushed.
+ */
+class CmdProducer
+{
+public:
+    enum class Kind { NIX, SQL };
+
+private:
+    std::shared_ptr<PG::conn> _conn;
+    std::string _cmd_class;  // As the `regclass::text` that's safe to use in SQL.
+    uint32_t _cmd_class_oid;
+    Kind _kind;
+    size_t _batch_size;
+
+    bool _in_batch = false;
+    size_t _batch_cmds = 0;
+    size_t _cmds_enqueued = 0;
+    std::string _buffer;  // `COPY` data that has yet to be sent.
+
+    void begin_batch();
+    void append_row(const std::string &cmd_id, const std::optional<std::string> &cmd_subid, int16_t field_count,
+                    const std::function<void(std::string &out)> &append_fields);
+    void put_buffer();
+    void abort_batch(const std::string &reason);
+    void exec_or_throw(const std::string &sql, ExecStatusType expected_status);
+
+public:
+    /**
+     * Looks up the queue in `cmdq.cmd_queue`, and throws if it's not there.
+     */
+    CmdProducer(const std::shared_ptr<PG::conn> &conn, const std::string &cmd_class, size_t batch_size = 10000);
+    CmdProducer(const CmdProducer &other) = delete;
+    CmdProducer &operator=(const CmdProducer &other) = delete;
+    ~CmdProducer();
+
+    Kind kind() const;
+
+    void enqueue_nix_cmd(const std::string &cmd_id,
+                         const std::optional<std::string> &cmd_subid,
+                         const std::vector<std::string> &cmd_argv,
+                         const std::unordered_map<std::string, std::optional<std::string>> &cmd_env = {},
+                         std::string_view cmd_stdin = {});
+
+    void enqueue_sql_cmd(const std::string &cmd_id,
+                         const std::optional<std::string> &cmd_subid,
+                         const std::string &cmd_sql,
+                         const std::optional<std::vector<std::optional<std::string>>> &cmd_sql_params = {});
+
+    /**
+     * End the current batch, `COMMIT`ing (and thus notifying the daemon of) the commands that are in it.
+     */
+    void flush();
+
+    /**
+     * The number of commands that have been committed so far.
+     */
+    size_t cmds_enqueued() const;
+};
+
+#endif // CMDPRODUCER_H
@@ -18,6 +18,28 @@ const std::string CmdQueue::SELECT_STMT = R"SQL(
         ,queue_reselect_interval_msec
         ,queue_reselect_randomized_every_nth
         ,queue_cmd_timeout_sec
+        ,queue_worker_argv
+        ,queue_worker_max_cmds
+        ,queue_output_codec
+        ,queue_max_stdout_bytes
+        ,queue_max_stderr_bytes
+        ,queue_output_capture
+        ,queue_output_spill_dir
+        ,queue_output_spill_threshold_bytes
+        ,queue_rlimit_as_bytes
+        ,queue_rlimit_cpu_sec
+        ,queue_rlimit_nofile
+        ,queue_cmd_nice
+        ,queue_cmd_ioprio_class
+        ,queue_cmd_ioprio_level
+        ,queue_cpu_set
+        ,queue_sched_policy
+        ,queue_max_result_rows
+        ,queue_max_result_bytes
+        ,queue_cmd_sql_cache_size
+        ,queue_group_commit_max_cmds
+        ,queue_group_commit_max_latency_msec
+        ,queue_parallel_cmds
         ,ansi_fg
     FROM
         cmdqd.cmd_queue
@@ -85,6 +107,169 @@ CmdQueue::CmdQueue(const PG::result &result,
         else
             this->queue_cmd_timeout_sec = 0;
 
+        if (not PQ::getisnull(result, row_number, field_numbers.at("queue_worker_argv")))
+        {
+            this->queue_worker_argv = PQ::from_text_array(PQ::getvalue(
+                    result,
+                    row_number,
+                    field_numbers.at("queue_worker_argv")));
+        }
+
+        if (not PQ::getisnull(result, row_number, field_numbers.at("queue_worker_max_cmds")))
+        {
+            std::string queue_worker_max_cmds = PQ::getvalue(
+                    result,
+                    row_number,
+                    field_numbers.at("queue_worker_max_cmds"));
+            this->queue_worker_max_cmds = std::stoi(queue_worker_max_cmds);
+        }
+
+        queue_output_codec = PQ::getnullable(
+                result,
+                row_number,
+                field_numbers.at("queue_output_codec"));
+
+        if (not PQ::getisnull(result, row_number, field_numbers.at("queue_max_stdout_bytes")))
+        {
+            std::string queue_max_stdout_bytes = PQ::getvalue(
+                    result,
+                    row_number,
+                    field_numbers.at("queue_max_stdout_bytes"));
+            this->queue_max_stdout_bytes = std::stoull(queue_max_stdout_bytes);
+        }
+
+        if (not PQ::getisnull(result, row_number, field_numbers.at("queue_max_stderr_bytes")))
+        {
+            std::string queue_max_stderr_bytes = PQ::getvalue(
+                    result,
+                    row_number,
+                    field_numbers.at("queue_max_stderr_bytes"));
+            this->queue_max_stderr_bytes = std::stoull(queue_max_stderr_bytes);
+        }
+
+        queue_output_capture = PQ::getvalue(
+                result,
+                row_number,
+                field_numbers.at("queue_output_capture"));
+
+        queue_output_spill_dir = PQ::getnullable(
+                result,
+                row_number,
+                field_numbers.at("queue_output_spill_dir"));
+
+        std::string queue_output_spill_threshold_bytes = PQ::getvalue(
+                result,
+                row_number,
+                field_numbers.at("queue_output_spill_threshold_bytes"));
+        this->queue_output_spill_threshold_bytes = std::stoull(queue_output_spill_threshold_bytes);
+
+        if (not PQ::getisnull(result, row_number, field_numbers.at("queue_rlimit_as_bytes")))
+        {
+            std::string queue_rlimit_as_bytes = PQ::getvalue(
+                    result,
+                    row_number,
+                    field_numbers.at("queue_rlimit_as_bytes"));
+            this->queue_rlimit_as_bytes = std::stoull(queue_rlimit_as_bytes);
+        }
+
+        if (not PQ::getisnull(result, row_number, field_numbers.at("queue_rlimit_cpu_sec")))
+        {
+            std::string queue_rlimit_cpu_sec = PQ::getvalue(
+                    result,
+                    row_number,
+                    field_numbers.at("queue_rlimit_cpu_sec"));
+            this->queue_rlimit_cpu_sec = std::stoi(queue_rlimit_cpu_sec);
+        }
+
+        if (not PQ::getisnull(result, row_number, field_numbers.at("queue_rlimit_nofile")))
+        {
+            std::string queue_rlimit_nofile = PQ::getvalue(
+                    result,
+                    row_number,
+                    field_numbers.at("queue_rlimit_nofile"));
+            this->queue_rlimit_nofile = std::stoi(queue_rlimit_nofile);
+        }
+
+        if (not PQ::getisnull(result, row_number, field_numbers.at("queue_cmd_nice")))
+        {
+            std::string queue_cmd_nice = PQ::getvalue(
+                    result,
+                    row_number,
+                    field_numbers.at("queue_cmd_nice"));
+            this->queue_cmd_nice = std::stoi(queue_cmd_nice);
+        }
+
+        queue_cmd_ioprio_class = PQ::getnullable(
+                result,
+                row_number,
+                field_numbers.at("queue_cmd_ioprio_class"));
+
+        if (not PQ::getisnull(result, row_number, field_numbers.at("queue_cmd_ioprio_level")))
+        {
+            std::string queue_cmd_ioprio_level = PQ::getvalue(
+                    result,
+                    row_number,
+                    field_numbers.at("queue_cmd_ioprio_level"));
+            this->queue_cmd_ioprio_level = std::stoi(queue_cmd_ioprio_level);
+        }
+
+        if (not PQ::getisnull(result, row_number, field_numbers.at("queue_cpu_set")))
+        {
+            const std::vector<std::string> queue_cpu_set = PQ::from_text_array(PQ::getvalue(
+                    result,
+                    row_number,
+                    field_numbers.at("queue_cpu_set")));
+            for (const std::string &cpu : queue_cpu_set)
+                this->queue_cpu_set.push_back(std::stoi(cpu));
+        }
+
+        queue_sched_policy = PQ::getnullable(
+                result,
+                row_number,
+                field_numbers.at("queue_sched_policy"));
+
+        if (not PQ::getisnull(result, row_number, field_numbers.at("queue_max_result_rows")))
+        {
+            std::string queue_max_result_rows = PQ::getvalue(
+                    result,
+                    row_number,
+                    field_numbers.at("queue_max_result_rows"));
+            this->queue_max_result_rows = std::stoull(queue_max_result_rows);
+        }
+
+        if (not PQ::getisnull(result, row_number, field_numbers.at("queue_max_result_bytes")))
+        {
+            std::string queue_max_result_bytes = PQ::getvalue(
+                    result,
+                    row_number,
+                    field_numbers.at("queue_max_result_bytes"));
+            this->queue_max_result_bytes = std::stoull(queue_max_result_bytes);
+        }
+
+        std::string queue_cmd_sql_cache_size = PQ::getvalue(
+                result,
+                row_number,
+                field_numbers.at("queue_cmd_sql_cache_size"));
+        this->queue_cmd_sql_cache_size = std::stoull(queue_cmd_sql_cache_size);
+
+        std::string queue_group_commit_max_cmds = PQ::getvalue(
+                result,
+                row_number,
+                field_numbers.at("queue_group_commit_max_cmds"));
+        this->queue_group_commit_max_cmds = std::stoi(queue_group_commit_max_cmds);
+
+        std::string queue_group_commit_max_latency_msec = PQ::getvalue(
+                result,
+                row_number,
+                field_numbers.at("queue_group_commit_max_latency_msec"));
+        this->queue_group_commit_max_latency_msec = std::stoi(queue_group_commit_max_latency_msec);
+
+        std::string queue_parallel_cmds = PQ::getvalue(
+                result,
+                row_number,
+                field_numbers.at("queue_parallel_cmds"));
+        this->queue_parallel_cmds = std::stoi(queue_parallel_cmds);
+
         ansi_fg = PQgetvalue(result.get(), row_number, field_numbers.at("ansi_fg"));
 
         _is_valid = true;
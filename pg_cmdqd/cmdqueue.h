@@ -2,8 +2,10 @@
 #define CMDQUEUE_H
 
 #include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "pq-raii/libpq-raii.hpp"
 
@@ -39,9 +41,79 @@ public:
 
     std::optional<std::string> queue_runner_role;
     std::optional<std::string> queue_notify_channel;
-    int queue_reselect_interval_msec;
+    int queue_reselect_interval_msec = 0;
     std::optional<int> queue_reselect_randomized_every_nth;
-    double queue_cmd_timeout_sec;
+    double queue_cmd_timeout_sec = 0;
+
+    /**
+     * The `argv` prefix with which to start a long-lived worker process; empty if the queue has no worker.
+     */
+    std::vector<std::string> queue_worker_argv;
+    std::optional<int> queue_worker_max_cmds;
+
+    /**
+     * The codec (currently only `"lz4"`) with which to compress `cmd_stdout` and `cmd_stderr` before they are
+     * written back to the queue; none if not set.
+     */
+    std::optional<std::string> queue_output_codec;
+
+    /**
+     * How many bytes of each command's STDOUT/STDERR to keep, at most; see `BoundedOutput`.
+     */
+    std::optional<size_t> queue_max_stdout_bytes;
+    std::optional<size_t> queue_max_stderr_bytes;
+
+    /**
+     * How the output of each command is captured: through `"pipe"`s, or in `"memfd"`s.
+     */
+    std::string queue_output_capture = "pipe";
+
+    /**
+     * The directory to which output bigger than `queue_output_spill_threshold_bytes` is moved; see `BlobStore`.
+     */
+    std::optional<std::string> queue_output_spill_dir;
+    size_t queue_output_spill_threshold_bytes = 1024 * 1024;
+
+    /**
+     * The resource limits and priorities of the processes that are started for this queue; see `ProcessLimits`.
+     */
+    std::optional<size_t> queue_rlimit_as_bytes;
+    std::optional<int> queue_rlimit_cpu_sec;
+    std::optional<int> queue_rlimit_nofile;
+    std::optional<int> queue_cmd_nice;
+    std::optional<std::string> queue_cmd_ioprio_class;
+    std::optional<int> queue_cmd_ioprio_level;
+
+    /**
+     * The CPUs to which the runner thread (and thus every process that it starts) is confined, and its
+     * scheduling policy (`"batch"` or `"idle"`), if any.
+     */
+    std::vector<int> queue_cpu_set;
+    std::optional<std::string> queue_sched_policy;
+
+    /**
+     * How many rows, and how many bytes of JSON, of the result of each `cmd_sql` to keep, at most.
+     */
+    std::optional<size_t> queue_max_result_rows;
+    std::optional<size_t> queue_max_result_bytes;
+
+    /**
+     * How many distinct `cmd_sql` statements with `cmd_sql_params` are kept prepared; see `PreparedStatementCache`.
+     */
+    size_t queue_cmd_sql_cache_size = 32;
+
+    /**
+     * How many commands, at most, are run and written back in one transaction, and for how long, at most, the
+     * transaction is kept open to add more commands to it.
+     */
+    int queue_group_commit_max_cmds = 1;
+    int queue_group_commit_max_latency_msec = 0;
+
+    /**
+     * How many commands the runner runs at the same time, each over its own connection.
+     */
+    int queue_parallel_cmds = 1;
+
     std::string ansi_fg;
 
     CmdQueue() = default;
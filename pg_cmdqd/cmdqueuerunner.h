@@ -2,11 +2,14 @@
 #define CMDQUEUERUNNER_H
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <functional>
 #include <limits>
+#include <list>
 #include <stdexcept>
 #include <thread>
+#include <type_traits>
 
 #include <fcntl.h>
 #include <libpq-fe.h>
@@ -20,6 +23,7 @@
 #include "logger.h"
 #include "nixqueuecmd.h"
 #include "pipefds.h"
+#include "processlimits.h"
 #include "sqlqueuecmd.h"
 #include "utils.h"
 
@@ -29,24 +33,80 @@ template <typename T>
 class CmdQueueRunner
 {
     bool _running = false;
-    bool _keep_running = true;
+    std::atomic<bool> _keep_running{true};
     CmdQueue _cmd_queue;
     std::string _conn_str;
     Logger *logger = Logger::getInstance();
     bool _is_prepared = false;
+    typename T::RunnerState _runner_state;
+
+    /**
+     * With `queue_parallel_cmds > 1`, every command beyond the first that can run at the same time gets a lane:
+     * a thread with its own connection, which selects, runs and updates commands independently of the runner's
+     * own thread.  (`FOR UPDATE SKIP LOCKED` keeps the lanes from selecting the same command.)
+     */
+    struct Lane
+    {
+        PipeFds kill_pipe_fds;
+        typename T::RunnerState runner_state;
+        std::thread thread;
+
+        Lane() : kill_pipe_fds(O_NONBLOCK) {}
+    };
+    std::list<Lane> _extra_lanes;  // A `std::list`, because a `Lane` can't be moved.
 
     void _run()
     {
         _running = true;
 
+        int lane_number = 1;
+        for (Lane &lane : _extra_lanes)
+        {
+            lane.thread = std::thread(&CmdQueueRunner<T>::_run_lane, this,
+                                      std::cref(lane.kill_pipe_fds), std::ref(lane.runner_state));
+#ifdef _GNU_SOURCE
+            pthread_setname_np(lane.thread.native_handle(),
+                               (_cmd_queue.cmd_class_relname.substr(0, 11) + "/" + std::to_string(lane_number)).c_str());
+#endif
+            lane_number++;
+        }
+
+        _run_lane(kill_pipe_fds, _runner_state);
+
+        // The other lanes don't outlive the runner's own thread.
+        _keep_running = false;
+        for (Lane &lane : _extra_lanes)
+        {
+            signal_lane(lane.kill_pipe_fds, 0);
+            if (lane.thread.joinable())
+                lane.thread.join();
+        }
+
+        _running = false;
+    }
+
+    void _run_lane(const PipeFds &lane_kill_pipe_fds, typename T::RunnerState &runner_state)
+    {
         Logger::cmd_queue = std::make_shared<CmdQueue>(_cmd_queue); // FIXME: This makes a copy
 
+        // The commands that this thread starts inherit its CPU affinity and scheduling policy.
+        const char *failed_call = ProcessLimits(_cmd_queue).apply_cpu_scheduling();
+        if (failed_call)
+        {
+            logger->log(LOG_ERROR, "Could not apply the queue's `queue_cpu_set` or `queue_sched_policy`: %s error: %s",
+                        failed_call, strerror(errno));
+        }
+
         const std::unordered_map<std::string, std::string> cmdqd_env = environ_to_unordered_map(environ);
 
         std::shared_ptr<PG::conn> conn = nullptr;
         struct pollfd poll_fds[2];
 
-        std::unordered_map<std::string, int> selected_field_numbers;
+        // Looked up once per lane, rather than by name for every command; see `PG::column_numbers`.
+        std::optional<typename T::ColumnNumbers> selected_columns;
+
+        // Reused for every command, so that binding the `UPDATE` parameters stops allocating after a while.
+        PG::params update_params;
 
         while (this->_keep_running)
         {
@@ -68,13 +128,21 @@ class CmdQueueRunner
             }
 
             poll_fds[0] = {PQ::socket(conn), POLLIN | POLLPRI, 0};
-            poll_fds[1] = {kill_pipe_fds.read_fd(), POLLIN | POLLPRI, 0};
+            poll_fds[1] = {lane_kill_pipe_fds.read_fd(), POLLIN | POLLPRI, 0};
 
-            if (selected_field_numbers.size() == 0)
+            if (not selected_columns)
             {
-                // The field mappings are the same for all the `SELECT` statements of the same `T`.
+                // The columns are the same for all the `SELECT` statements of the same `T`.
                 PG::result result = PQ::describePrepared(conn, "select_oldest_cmd");
-                selected_field_numbers = PQ::fnumbers(result);
+                try
+                {
+                    selected_columns.emplace(result, T::COLUMNS);
+                }
+                catch (std::invalid_argument &ex)
+                {
+                    logger->log(LOG_ERROR, "Unexpected `select_oldest_cmd` result: %s", ex.what());
+                    break;  // Reconnecting won't change the columns of the `SELECT` statements.
+                }
             }
 
             int reselect_round = 0;
@@ -89,7 +157,8 @@ class CmdQueueRunner
 
                 PQ::exec(conn, "BEGIN TRANSACTION");
 
-                PG::result select_result(nullptr);
+                // Shared, because the commands constructed from its rows may hold on to it; see `PG::row`.
+                std::shared_ptr<PG::result> select_result;
 
                 if (notify_cmd)
                 {
@@ -100,66 +169,121 @@ class CmdQueueRunner
                                     ? (std::string("'") + std::get<2>(notify_cmd.value()).value() + "'").c_str()
                                     : "NULL");
 
-                    select_result = PQ::execPrepared(
-                        conn, "select_notify_cmd", 2,
+                    select_result = exec_select_cmd(
+                        conn, "select_notify_cmd",
                         {std::get<1>(notify_cmd.value()), std::get<2>(notify_cmd.value())});
                 }
                 else if (_cmd_queue.queue_reselect_randomized_every_nth and reselect_round % _cmd_queue.queue_reselect_randomized_every_nth.value() == 0)
                 {
                     logger->log(LOG_DEBUG3, "Getting random queue_cmd from cmd_queue…");
-                    select_result = PQ::execPrepared(conn, "select_random_cmd");
+                    select_result = exec_select_cmd(conn, "select_random_cmd");
                 }
                 else
                 {
                     logger->log(LOG_DEBUG3, "Getting oldest queue_cmd from cmd_queue…");
-                    select_result = PQ::execPrepared(conn, "select_oldest_cmd");
+                    select_result = exec_select_cmd(conn, "select_oldest_cmd");
                 }
 
-                if (PQ::resultStatus(select_result) != PGRES_TUPLES_OK)
+                if (PQ::resultStatus(*select_result) != PGRES_TUPLES_OK)
                 {
                     logger->log(LOG_ERROR, "Retrieving command from queue failed: %s",
                                 PQerrorMessage(conn->get()));
                 }
-                else if (PQntuples(select_result.get()) == 1)
+                else if (PQ::ntuples(*select_result) == 1)
                 {
-                    T queue_cmd(select_result, 0, selected_field_numbers);
+                    // In group-commit mode, we keep running commands in the same transaction until we have run
+                    // `queue_group_commit_max_cmds` commands, until the queue is empty, or until the group's
+                    // latency would become too high.  Each command gets its own savepoint, so that a failed
+                    // `UPDATE` doesn't take the commands before it in the same group down with it.
+                    const bool group_commit = _cmd_queue.queue_group_commit_max_cmds > 1;
+                    const std::chrono::steady_clock::time_point group_deadline
+                        = std::chrono::steady_clock::now()
+                          + std::chrono::milliseconds(_cmd_queue.queue_group_commit_max_latency_msec);
+                    int group_cmd_count = 0;
+
+                    while (true)
+                    {
+                        if (group_commit)
+                            PQ::exec(conn, "SAVEPOINT group_cmd");
 
-                    queue_cmd.meta.stamp_start_time();
+                        T queue_cmd(PG::row(select_result, 0), selected_columns.value());
 
-                    logger->log(LOG_NOTICE, "Starting cmd_id = %s (%s)", queue_cmd.meta.cmd_id.c_str(), queue_cmd.meta.cmd_class_identity.c_str());
+                        queue_cmd.meta.stamp_start_time();
 
-                    // Delegate the execution of the command to the specific `(Nix|Sql|Http)QueueCommand`.
-                    // `conn` is passed to `run_cmd()` solely because `SqlQueueCommand` needs the connection.
-                    queue_cmd.run_cmd(conn, _cmd_queue.queue_cmd_timeout_sec);
+                        logger->log(LOG_NOTICE, "Starting cmd_id = %s (%s)", queue_cmd.meta.cmd_id.c_str(), queue_cmd.meta.cmd_class_identity.c_str());
 
-                    logger->log(LOG_NOTICE, "Finished cmd_id = %s (%s)", queue_cmd.meta.cmd_id.c_str(), queue_cmd.meta.cmd_class_identity.c_str());
+                        // Delegate the execution of the command to the specific `(Nix|Sql|Http)QueueCommand`.
+                        // `conn` is passed to `run_cmd()` solely because `SqlQueueCommand` needs the connection.
+                        queue_cmd.run_cmd(conn, _cmd_queue, runner_state);
 
-                    queue_cmd.meta.stamp_end_time();
+                        logger->log(LOG_NOTICE, "Finished cmd_id = %s (%s)", queue_cmd.meta.cmd_id.c_str(), queue_cmd.meta.cmd_class_identity.c_str());
 
-                    PG::result update_result = PQ::execPrepared(
-                            conn, "update_cmd", queue_cmd.update_params().size(),
-                            queue_cmd.update_params(), queue_cmd.update_param_lengths(),
-                            queue_cmd.update_param_formats());
-                    if (PQ::resultStatus(update_result) != PGRES_COMMAND_OK)
-                    {
-                        logger->log(LOG_ERROR, "SQL UPDATE for command %s failed: %s",
-                                    queue_cmd.meta.cmd_id.c_str(), PQ::resultErrorMessage(update_result).c_str());
+                        queue_cmd.meta.stamp_end_time();
+
+                        update_params.clear();
+                        queue_cmd.bind_update_params(update_params);
+                        PG::result update_result = PQ::execPrepared(conn, "update_cmd", update_params);
+                        if (PQ::resultStatus(update_result) != PGRES_COMMAND_OK)
+                        {
+                            logger->log(LOG_ERROR, "SQL UPDATE for command %s failed: %s",
+                                        queue_cmd.meta.cmd_id.c_str(), PQ::resultErrorMessage(update_result).c_str());
+
+                            if (group_commit)
+                            {
+                                // Keep the rest of the group, but end it here, because the failed command can
+                                // only be excluded from the rest of this reselect round outside the transaction.
+                                PQ::exec(conn, "ROLLBACK TO SAVEPOINT group_cmd");
+                                PQ::exec(conn, "COMMIT TRANSACTION");
+                            }
+                            else
+                                PQ::exec(conn, "ROLLBACK TRANSACTION");
+
+                            PG::result log_failed_update_result = PQ::execParams(
+                                    conn, "CALL cmdqd.remember_failed_update_for_this_reselect_round($1, $2)",
+                                    2, {}, {queue_cmd.meta.cmd_id, queue_cmd.meta.cmd_subid});
+                            if (PQ::resultStatus(log_failed_update_result) != PGRES_COMMAND_OK)
+                            {
+                                logger->log(LOG_ERROR, "Even registering the failed update failed: %s",
+                                            PQ::resultErrorMessage(log_failed_update_result).c_str());
+                            }
+                            break;
+                        }
+
+                        if (not group_commit)
+                            break;
 
-                        PQ::exec(conn, "ROLLBACK TRANSACTION");
+                        PQ::exec(conn, "RELEASE SAVEPOINT group_cmd");
 
-                        PG::result log_failed_update_result = PQ::execParams(
-                                conn, "CALL cmdqd.remember_failed_update_for_this_reselect_round($1, $2)",
-                                2, {}, {queue_cmd.meta.cmd_id, queue_cmd.meta.cmd_subid});
-                        if (PQ::resultStatus(log_failed_update_result) != PGRES_COMMAND_OK)
+                        if (++group_cmd_count >= _cmd_queue.queue_group_commit_max_cmds
+                            or std::chrono::steady_clock::now() >= group_deadline
+                            or not _keep_running
+                            or kill_pending(lane_kill_pipe_fds))
+                            break;
+
+                        logger->log(LOG_DEBUG3, "Getting oldest queue_cmd from cmd_queue for the same group…");
+                        PQ::exec(conn, "SAVEPOINT group_select");
+                        select_result = exec_select_cmd(conn, "select_oldest_cmd");
+                        if (PQ::resultStatus(*select_result) != PGRES_TUPLES_OK)
                         {
-                            logger->log(LOG_ERROR, "Even registering the failed update failed: %s",
-                                        PQ::resultErrorMessage(log_failed_update_result).c_str());
+                            logger->log(LOG_ERROR, "Retrieving the next command for the group failed: %s",
+                                        PQ::resultErrorMessage(*select_result).c_str());
+
+                            // Had the failed `SELECT` aborted the transaction, the commands that already ran in
+                            // this group would be rolled back with it, and then run again.  Now, they will be
+                            // committed below, after which we back off until the next reselect round.
+                            PQ::exec(conn, "ROLLBACK TO SAVEPOINT group_select");
+                            reselect_next_when = std::chrono::steady_clock::now()
+                                                 + std::chrono::milliseconds(_cmd_queue.queue_reselect_interval_msec);
+                            break;
                         }
+                        PQ::exec(conn, "RELEASE SAVEPOINT group_select");
+                        if (PQ::ntuples(*select_result) != 1)
+                            break;
                     }
                 }
                 else
                 {
-                    assert(PQ::ntuples(select_result) == 0);
+                    assert(PQ::ntuples(*select_result) == 0);
 
                     if (not notify_cmd)
                     {
@@ -222,7 +346,8 @@ class CmdQueueRunner
                             // The payload of all the `pg_cmd_queue`-compatible notifcation should consist of a
                             // text-encoded composite value with:
                             // 1. the qualified name of the queue command relation;
-                            // 2. the `cmd_id`; and
+                            // 2. the `cmd_id` (or `NULL` for a batch of commands; see `pg_cmd_queue.coalesce_notify`);
+                            //    and
                             // 3. the optional `cmd_subid`.
                             notify_payload_fields = PQ::from_text_composite_value((notify->extra()));
                             if (notify_payload_fields.size() != 3)
@@ -232,9 +357,6 @@ class CmdQueueRunner
                             if (not notify_payload_fields[0].has_value())
                                 throw std::runtime_error(
                                     "The 1st field (`cmd_class_identity`) in NOTIFY payload may not be `NULL`");
-                            if (not notify_payload_fields[1].has_value())
-                                throw std::runtime_error(
-                                    "The 2nd field (`cmd_id`) in NOTIFY payload may not be `NULL`");
                         }
                         catch (const std::exception &err)
                         {
@@ -245,7 +367,20 @@ class CmdQueueRunner
                             continue; // Let's go check for another `NOTIFY` in the libpq queue.
                         }
 
-                        if (notify_payload_fields[0].value() == _cmd_queue.cmd_class_identity)
+                        if (notify_payload_fields[0].value() == _cmd_queue.cmd_class_identity
+                            and not notify_payload_fields[1].has_value())
+                        {
+                            logger->log(LOG_DEBUG1,
+                                        "It appears as if this NOTIFY event on the `%s` channel is for a batch of"
+                                        " commands for me: %s",
+                                        notify->relname().c_str(),
+                                        notify->extra().c_str());
+                            // The (re)select loop will go on `SELECT`ing the oldest command until there are none
+                            // left, without waiting for the `queue_reselect_interval_msec`.
+                            reselect_next_when = std::chrono::steady_clock::now();
+                            break;
+                        }
+                        else if (notify_payload_fields[0].value() == _cmd_queue.cmd_class_identity)
                         {
                             logger->log(LOG_DEBUG1,
                                         "It appears as if this NOTIFY event on the `%s` channel is for me: %s",
@@ -278,7 +413,6 @@ class CmdQueueRunner
                         if (errno == EINTR)
                             continue; // We will see if `_keep_running` turned `false`.
                         logger->log(LOG_ERROR, "poll() failed: %s", strerror(errno));
-                        _running = false;
                         return; // Leave this runner thread.
                     }
                     if (fd_count == 0)
@@ -296,12 +430,12 @@ class CmdQueueRunner
                         // in the next iteration of this loop.
                     }
 
-                    if (poll_fds[1].revents != 0)  // poll_fd[1].fd = kill_pipe_fds.read_fd()
+                    if (poll_fds[1].revents != 0)  // poll_fd[1].fd = lane_kill_pipe_fds.read_fd()
                     {
                         int sig_num = -1;
                         int sig_num_bytes_total = 0;
                         int sig_num_bytes_read = 0;
-                        while ((sig_num_bytes_read = read(kill_pipe_fds.read_fd(),
+                        while ((sig_num_bytes_read = read(lane_kill_pipe_fds.read_fd(),
                                                           &sig_num + sig_num_bytes_total * sizeof(char),
                                                           sizeof(int))) > 0)
                         {
@@ -314,7 +448,6 @@ class CmdQueueRunner
                             logger->log(LOG_ERROR,
                                         "Unexpected error while reading from kill pipe FD: %s",
                                         strerror(errno));
-                            _running = false;
                             return;
                         }
                         logger->log(LOG_DEBUG1,
@@ -327,8 +460,52 @@ class CmdQueueRunner
             }  // (re)select loop
         }  // (re)connect loop
         logger->log(LOG_DEBUG5, "Exited outer/(re)connect loop");
+    }
 
-        _running = false;
+    /**
+     * Execute one of the prepared `select_*_cmd` statements, with the result in binary format, which spares the
+     * server from escaping, and us from unescaping, the `text[]`, `hstore` and `bytea` fields of every command.
+     */
+    std::shared_ptr<PG::result> exec_select_cmd(const std::shared_ptr<PG::conn> &conn,
+                                                const std::string &stmt_name,
+                                                const std::vector<std::optional<std::string>> &params = {})
+    {
+        return std::make_shared<PG::result>(PQ::execPrepared(conn, stmt_name, params.size(), params, {}, {}, 1));
+    }
+
+    /**
+     * Whether there's a signal in the kill pipe that the `poll()` loop has yet to pick up.
+     */
+    bool kill_pending(const PipeFds &lane_kill_pipe_fds)
+    {
+        struct pollfd kill_poll_fd = {lane_kill_pipe_fds.read_fd(), POLLIN, 0};
+        return poll(&kill_poll_fd, 1, 0) > 0;
+    }
+
+    void signal_lane(const PipeFds &lane_kill_pipe_fds, int sig_num)
+    {
+        // Write signal number to the pipe, to bust the `poll()` loop in the runner thread out of its wait.
+        // We stupidly write the binary representation of the `int`, knowing that the endianness at the other
+        // end of the pipe is the same, since we're the same program (though not the same thread).
+        size_t kill_pipe_bytes_written = 0;
+        size_t kill_pipe_bytes_to_write = sizeof(int);
+        size_t kill_pipe_ptr_offset = 0;
+        while ((kill_pipe_bytes_written = write(lane_kill_pipe_fds.write_fd(),
+                                                &sig_num + kill_pipe_ptr_offset,
+                                                kill_pipe_bytes_to_write)
+               ) > 0
+               or (kill_pipe_bytes_written < 0 and errno == EINTR))
+        {
+            kill_pipe_bytes_to_write -= kill_pipe_bytes_written;
+            kill_pipe_ptr_offset += kill_pipe_bytes_written;
+        }
+        if (kill_pipe_bytes_written < 0)
+        {
+            // We an do this non-signal safe thing, because we're not in a signal handler.
+            logger->log(LOG_ERROR,
+                        "Error while trying to pass signal from main thread to event loop in runner thread: %s",
+                        strerror(errno));
+        }
     }
 
 public:
@@ -342,6 +519,16 @@ public:
                                                                              _conn_str(conn_str),
                                                                              kill_pipe_fds(O_NONBLOCK)
     {
+        for (int lane_number = 1; lane_number < cmd_queue.queue_parallel_cmds; lane_number++)
+            _extra_lanes.emplace_back();
+
+        if constexpr (std::is_same<T, SqlQueueCmd>::value)
+        {
+            _runner_state.kill_fd = kill_pipe_fds.read_fd();
+            for (Lane &lane : _extra_lanes)
+                lane.runner_state.kill_fd = lane.kill_pipe_fds.read_fd();
+        }
+
         auto f = std::bind(&CmdQueueRunner<T>::_run, this);
         thread = std::thread(f);
 
@@ -373,28 +560,9 @@ public:
                         sig_num,
                         _cmd_queue.cmd_class_identity.c_str());
 
-        // Write signal number to the pipe, to bust the `poll()` loop in the runner thread out of its wait.
-        // We stupidly write the binary representation of the `int`, knowing that the endianness at the other
-        // end of the pipe is the same, since we're the same program (though not the same thread).
-        size_t kill_pipe_bytes_written = 0;
-        size_t kill_pipe_bytes_to_write = sizeof(int);
-        size_t kill_pipe_ptr_offset = 0;
-        while ((kill_pipe_bytes_written = write(kill_pipe_fds.write_fd(),
-                                                &sig_num + kill_pipe_ptr_offset,
-                                                kill_pipe_bytes_to_write)
-               ) > 0
-               or (kill_pipe_bytes_written < 0 and errno == EINTR))
-        {
-            kill_pipe_bytes_to_write -= kill_pipe_bytes_written;
-            kill_pipe_ptr_offset += kill_pipe_bytes_written;
-        }
-        if (kill_pipe_bytes_written < 0)
-        {
-            // We an do this non-signal safe thing, because we're not in a signal handler.
-            logger->log(LOG_ERROR,
-                        "Error while trying to pass signal from main thread to event loop in runner thread: %s",
-                        strerror(errno));
-        }
+        signal_lane(kill_pipe_fds, sig_num);
+        for (Lane &lane : _extra_lanes)
+            signal_lane(lane.kill_pipe_fds, sig_num);
     }
 };
 
@@ -0,0 +1,66 @@
+#include "executablecache.h"
+
+#include <unistd.h>
+
+ExecutableCache::ExecutableCache(std::chrono::steady_clock::duration ttl)
+    : _ttl(ttl)
+{
+}
+
+std::optional<std::string> ExecutableCache::resolve(const std::string &file, const std::string &path_var)
+{
+    if (file.empty())
+        return {};
+    if (file.find('/') != std::string::npos)
+        return file;
+
+    const std::string key = path_var + '\0' + file;
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    struct stat st;
+
+    auto it = _entries.find(key);
+    if (it != _entries.end())
+    {
+        const Entry &entry = it->second;
+        if (now - entry.resolved_at < _ttl
+            and stat(entry.path.c_str(), &st) == 0
+            and st.st_dev == entry.dev
+            and st.st_ino == entry.ino
+            and st.st_size == entry.size
+            and st.st_mtime == entry.mtime)
+        {
+            return entry.path;
+        }
+        _entries.erase(it);
+    }
+
+    std::optional<std::string> path = search_path(file, path_var, st);
+    if (path)
+        _entries[key] = {path.value(), st.st_dev, st.st_ino, st.st_size, st.st_mtime, now};
+
+    return path;
+}
+
+std::optional<std::string> ExecutableCache::search_path(const std::string &file,
+                                                        const std::string &path_var,
+                                                        struct stat &st)
+{
+    std::string::size_type dir_start = 0;
+    while (dir_start <= path_var.size())
+    {
+        std::string::size_type dir_end = path_var.find(':', dir_start);
+        if (dir_end == std::string::npos)
+            dir_end = path_var.size();
+
+        // Like `execvp()`, we treat an empty `PATH` entry as the current directory.
+        std::string dir = path_var.substr(dir_start, dir_end - dir_start);
+        std::string candidate = dir.empty() ? file : dir + "/" + file;
+
+        if (stat(candidate.c_str(), &st) == 0 and S_ISREG(st.st_mode) and access(candidate.c_str(), X_OK) == 0)
+            return candidate;
+
+        dir_start = dir_end + 1;
+    }
+
+    return {};
+}
@@ -0,0 +1,53 @@
+#ifndef EXECUTABLECACHE_H
+#define EXECUTABLECACHE_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <chrono>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Remembers where in the `PATH` each command's `argv[0]` was found, so that it needn't be searched for
+ * (with a failed `execve()` for every `PATH` entry that doesn't have it) every time it is run.
+ *
+ * A cached location is only used as long as the file there still has the same device, inode, size and
+ * mtime, and not after `ttl` has expired, so that a newly installed executable that comes earlier in the
+ * `PATH` is picked up soon enough.  Failed lookups are not cached.
+ */
+class ExecutableCache
+{
+    struct Entry
+    {
+        std::string path;
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        time_t mtime;
+        std::chrono::steady_clock::time_point resolved_at;
+    };
+
+    std::unordered_map<std::string, Entry> _entries;
+    std::chrono::steady_clock::duration _ttl;
+
+public:
+    ExecutableCache(std::chrono::steady_clock::duration ttl = std::chrono::seconds(10));
+
+    /**
+     * The full path of the executable that `execvp()` would run for `file`, given `path_var` as the `PATH`.
+     * When `file` contains a slash, it is returned as-is, just like `execvp()` doesn't search the `PATH`
+     * for it.
+     */
+    std::optional<std::string> resolve(const std::string &file, const std::string &path_var);
+
+    /**
+     * Search `path_var` for an executable, regular file named `file`, and `stat()` it into `st`.
+     */
+    static std::optional<std::string> search_path(const std::string &file,
+                                                  const std::string &path_var,
+                                                  struct stat &st);
+};
+
+#endif // EXECUTABLECACHE_H
@@ -0,0 +1,163 @@
+#include "jsonrowsencoder.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+static const Oid BOOLOID = 16;
+static const Oid INT8OID = 20;
+static const Oid INT2OID = 21;
+static const Oid INT4OID = 23;
+static const Oid OIDOID = 26;
+static const Oid JSONOID = 114;
+static const Oid FLOAT4OID = 700;
+static const Oid FLOAT8OID = 701;
+static const Oid NUMERICOID = 1700;
+static const Oid JSONBOID = 3802;
+
+JsonRowsEncoder::JsonRowsEncoder(std::optional<size_t> max_rows, std::optional<size_t> max_bytes)
+    : _max_rows(max_rows), _max_bytes(max_bytes)
+{
+}
+
+void JsonRowsEncoder::start_result_set()
+{
+    _keys.clear();
+    _types.clear();
+}
+
+void JsonRowsEncoder::append_json_string(std::string &out, const char *str, size_t len)
+{
+    out.push_back('"');
+    for (size_t i = 0; i < len; i++)
+    {
+        const unsigned char c = str[i];
+        switch (c)
+        {
+            case '"': out.append("\\\""); break;
+            case '\\': out.append("\\\\"); break;
+            case '\b': out.append("\\b"); break;
+            case '\f': out.append("\\f"); break;
+            case '\n': out.append("\\n"); break;
+            case '\r': out.append("\\r"); break;
+            case '\t': out.append("\\t"); break;
+            default:
+                if (c < 0x20)
+                {
+                    char escaped[7];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out.append(escaped);
+                }
+                else
+                    out.push_back(c);
+        }
+    }
+    out.push_back('"');
+}
+
+void JsonRowsEncoder::encode_value(std::string &out, const PG::result &result, int row, int column) const
+{
+    if (PQgetisnull(result.get(), row, column))
+    {
+        out.append("null");
+        return;
+    }
+
+    const char *value = PQgetvalue(result.get(), row, column);
+    const size_t len = PQgetlength(result.get(), row, column);
+
+    switch (_types[column])
+    {
+        case BOOLOID:
+            out.append(value[0] == 't' ? "true" : "false");
+            return;
+        case INT2OID:
+        case INT4OID:
+        case INT8OID:
+        case OIDOID:
+        case FLOAT4OID:
+        case FLOAT8OID:
+        case NUMERICOID:
+            // `NaN` and `Infinity` are not valid JSON numbers.
+            if (len > 0 and (isdigit(value[0]) or (value[0] == '-' and len > 1 and isdigit(value[1]))))
+            {
+                out.append(value, len);
+                return;
+            }
+            break;
+        case JSONOID:
+        case JSONBOID:
+            out.append(value, len);
+            return;
+    }
+
+    append_json_string(out, value, len);
+}
+
+void JsonRowsEncoder::append_rows(const PG::result &result)
+{
+    const int nfields = PQnfields(result.get());
+    if (_keys.size() != static_cast<size_t>(nfields))
+    {
+        _keys.clear();
+        _types.clear();
+        for (int column = 0; column < nfields; column++)
+        {
+            const char *fname = PQfname(result.get(), column);
+            std::string key;
+            append_json_string(key, fname, strlen(fname));
+            key.push_back(':');
+            _keys.push_back(key);
+            _types.push_back(PQftype(result.get(), column));
+        }
+    }
+
+    const int ntuples = PQntuples(result.get());
+    for (int row = 0; row < ntuples; row++)
+    {
+        if (_rows_dropped > 0 or (_max_rows and _rows >= _max_rows.value()))
+        {
+            _rows_dropped++;
+            continue;
+        }
+
+        _row_json.clear();
+        if (_rows > 0)
+            _row_json.push_back(',');
+        _row_json.push_back('{');
+        for (int column = 0; column < nfields; column++)
+        {
+            if (column > 0)
+                _row_json.push_back(',');
+            _row_json.append(_keys[column]);
+            encode_value(_row_json, result, row, column);
+        }
+        _row_json.push_back('}');
+
+        // One byte is kept in reserve for the closing `]`.
+        if (_max_bytes and _json.size() + _row_json.size() + 1 > _max_bytes.value())
+        {
+            _rows_dropped++;
+            continue;
+        }
+
+        _json.append(_row_json);
+        _rows++;
+    }
+}
+
+std::string JsonRowsEncoder::finish()
+{
+    _json.push_back(']');
+    return std::move(_json);
+}
+
+size_t JsonRowsEncoder::rows() const
+{
+    return _rows;
+}
+
+size_t JsonRowsEncoder::rows_dropped() const
+{
+    return _rows_dropped;
+}
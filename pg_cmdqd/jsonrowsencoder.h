@@ -0,0 +1,60 @@
+#ifndef JSONROWSENCODER_H
+#define JSONROWSENCODER_H
+
+#include <stddef.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "pq-raii/libpq-raii.hpp"
+
+/**
+ * Encodes the rows of a query result into a JSON array of objects (the `cmd_sql_result_rows`), one
+ * `PG::result` at a time, so that a result set fetched in single-row or chunked mode never has to be held
+ * in memory as a whole.
+ *
+ * Numbers, booleans, `json` and `jsonb` become their JSON counterparts, `NULL`s become `null` and all other
+ * values become JSON strings of their text representation.  (Unlike `to_jsonb()`, this leaves arrays and
+ * composite values as strings.)
+ *
+ * Once taking a row would exceed `max_rows` or `max_bytes`, that row and all rows after it are only counted.
+ */
+class JsonRowsEncoder
+{
+    std::optional<size_t> _max_rows;
+    std::optional<size_t> _max_bytes;
+
+    std::string _json = "[";
+    std::string _row_json;
+    size_t _rows = 0;
+    size_t _rows_dropped = 0;
+
+    std::vector<std::string> _keys;  // The JSON-encoded column names, followed by a colon.
+    std::vector<Oid> _types;
+
+    void encode_value(std::string &out, const PG::result &result, int row, int column) const;
+
+public:
+    JsonRowsEncoder(std::optional<size_t> max_rows = std::nullopt, std::optional<size_t> max_bytes = std::nullopt);
+
+    /**
+     * Call this when the rows to come may have different columns than the rows before them, as when `cmd_sql`
+     * consists of several statements.
+     */
+    void start_result_set();
+
+    void append_rows(const PG::result &result);
+
+    /**
+     * The JSON array of all the rows that were taken.
+     */
+    std::string finish();
+
+    size_t rows() const;
+    size_t rows_dropped() const;
+
+    static void append_json_string(std::string &out, const char *str, size_t len);
+};
+
+#endif // JSONROWSENCODER_H
@@ -0,0 +1,104 @@
+#ifndef LINESPLITTER_H
+#define LINESPLITTER_H
+
+#include <string.h>
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Incrementally splits a growing, append-only buffer (like a command's `cmd_stderr`) into lines.
+ *
+ * Rather than copying bytes into a line buffer of its own, the splitter only remembers up to where it has
+ * scanned the buffer and where the current, still unterminated line starts; complete lines are handed to
+ * the callback as `std::string_view`s into the buffer itself.  Both `'\n'` and `'\r'` end a line, so that
+ * progress bars that redraw themselves with a carriage return also produce log lines.  Empty lines are
+ * skipped.
+ *
+ * The spans of all the lines found are remembered, so that they can be replayed (with `replay()`) without
+ * scanning the buffer all over again.
+ */
+class LineSplitter
+{
+    std::string::size_type _line_start = 0;
+    std::string::size_type _scanned_pos = 0;
+    std::vector<std::pair<std::string::size_type, std::string::size_type>> _line_spans;
+
+    template <typename F>
+    void emit(const std::string &buf, std::string::size_type start, std::string::size_type end, F &on_line)
+    {
+        if (end == start)
+            return;
+        _line_spans.emplace_back(start, end - start);
+        on_line(std::string_view(buf.data() + start, end - start));
+    }
+
+public:
+    /**
+     * Find the lines that have been completed since the previous call, and pass each of them to `on_line`.
+     */
+    template <typename F>
+    void feed(const std::string &buf, F on_line)
+    {
+        if (buf.size() < _scanned_pos)
+        {
+            // The buffer has been replaced rather than appended to; start over.
+            _line_start = _scanned_pos = 0;
+            _line_spans.clear();
+        }
+
+        const char *const begin = buf.data();
+        const char *const end = begin + buf.size();
+        const char *p = begin + _scanned_pos;
+
+        // Look for the next `'\n'` only once, and then look for `'\r'`s only up to there, so that a long run
+        // of carriage returns doesn't make us search for the same newline over and over again.
+        const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+        while (p < end)
+        {
+            const char *line_end_limit = nl ? nl : end;
+            const char *cr = static_cast<const char *>(memchr(p, '\r', line_end_limit - p));
+            const char *eol = cr ? cr : nl;
+            if (eol == nullptr)
+                break;
+
+            emit(buf, _line_start, eol - begin, on_line);
+            p = eol + 1;
+            _line_start = p - begin;
+
+            if (eol == nl)
+                nl = static_cast<const char *>(memchr(p, '\n', end - p));
+        }
+
+        _scanned_pos = buf.size();
+    }
+
+    /**
+     * Like `feed()`, but also pass on the final line, even if it isn't terminated.
+     */
+    template <typename F>
+    void finish(const std::string &buf, F on_line)
+    {
+        feed(buf, on_line);
+        emit(buf, _line_start, buf.size(), on_line);
+        _line_start = buf.size();
+    }
+
+    /**
+     * Pass all the lines found so far in `buf` to `on_line` again.
+     */
+    template <typename F>
+    void replay(const std::string &buf, F on_line) const
+    {
+        for (const std::pair<std::string::size_type, std::string::size_type> &span : _line_spans)
+        {
+            if (span.first + span.second > buf.size())
+                break;
+            on_line(std::string_view(buf.data() + span.first, span.second));
+        }
+    }
+};
+
+#endif // LINESPLITTER_H
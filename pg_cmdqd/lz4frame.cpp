@@ -0,0 +1,180 @@
+#include "lz4frame.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+static const uint32_t LZ4_FRAME_MAGIC = 0x184D2204;
+static const size_t LZ4_BLOCK_MAX_SIZE = 4 * 1024 * 1024;
+static const uint8_t LZ4_BD_BLOCK_MAX_SIZE_4MB = 7 << 4;
+static const uint8_t LZ4_FLG_VERSION_01 = 1 << 6;
+static const uint8_t LZ4_FLG_BLOCK_INDEPENDENCE = 1 << 5;
+static const uint32_t LZ4_BLOCK_UNCOMPRESSED_FLAG = 0x80000000;
+
+static const size_t MIN_MATCH = 4;
+static const size_t LAST_LITERALS = 5;  // The last 5 bytes of a block are always literals.
+static const size_t MF_LIMIT = 12;      // And a match cannot start in the last 12 bytes of a block.
+static const int HASH_LOG = 12;
+static const size_t MAX_OFFSET = 65535;
+
+static uint32_t read_u32(const char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void append_le32(std::string &out, uint32_t v)
+{
+    const char bytes[4] = {
+        static_cast<char>(v & 0xFF),
+        static_cast<char>((v >> 8) & 0xFF),
+        static_cast<char>((v >> 16) & 0xFF),
+        static_cast<char>((v >> 24) & 0xFF),
+    };
+    out.append(bytes, sizeof(bytes));
+}
+
+static void append_length_extension(std::string &out, size_t len)
+{
+    while (len >= 255)
+    {
+        out.push_back(static_cast<char>(255));
+        len -= 255;
+    }
+    out.push_back(static_cast<char>(len));
+}
+
+static void append_sequence(std::string &out,
+                            const char *literals, size_t literal_len,
+                            size_t offset, size_t match_len)
+{
+    const size_t match_code = match_len - MIN_MATCH;
+    uint8_t token = (literal_len < 15 ? literal_len : 15) << 4;
+    if (match_len > 0)
+        token |= (match_code < 15 ? match_code : 15);
+    out.push_back(static_cast<char>(token));
+
+    if (literal_len >= 15)
+        append_length_extension(out, literal_len - 15);
+    out.append(literals, literal_len);
+
+    if (match_len == 0)
+        return;  // The last sequence of a block has literals only.
+
+    out.push_back(static_cast<char>(offset & 0xFF));
+    out.push_back(static_cast<char>((offset >> 8) & 0xFF));
+    if (match_code >= 15)
+        append_length_extension(out, match_code - 15);
+}
+
+static uint32_t hash_sequence(uint32_t seq)
+{
+    return (seq * 2654435761U) >> (32 - HASH_LOG);
+}
+
+static std::string lz4_block_compress(const char *src, size_t len)
+{
+    std::string out;
+    out.reserve(len / 2);
+
+    size_t anchor = 0;
+
+    if (len > MF_LIMIT)
+    {
+        std::vector<int32_t> table(1 << HASH_LOG, -1);
+        const size_t match_start_limit = len - MF_LIMIT;
+        const size_t match_end_limit = len - LAST_LITERALS;
+
+        size_t pos = 0;
+        while (pos <= match_start_limit)
+        {
+            const uint32_t seq = read_u32(src + pos);
+            const uint32_t h = hash_sequence(seq);
+            const int32_t candidate = table[h];
+            table[h] = static_cast<int32_t>(pos);
+
+            if (candidate < 0 or pos - candidate > MAX_OFFSET or read_u32(src + candidate) != seq)
+            {
+                pos++;
+                continue;
+            }
+
+            size_t match_len = MIN_MATCH;
+            while (pos + match_len < match_end_limit and src[candidate + match_len] == src[pos + match_len])
+                match_len++;
+
+            append_sequence(out, src + anchor, pos - anchor, pos - candidate, match_len);
+            pos += match_len;
+            anchor = pos;
+        }
+    }
+
+    append_sequence(out, src + anchor, len - anchor, 0, 0);
+
+    return out;
+}
+
+/**
+ * XXH32 of `len` bytes, with seed 0.  We only need it for the 2-byte frame descriptor, so this only
+ * implements the path for inputs shorter than 16 bytes.
+ */
+static uint32_t xxh32_short(const uint8_t *p, size_t len)
+{
+    const uint32_t PRIME1 = 2654435761U, PRIME2 = 2246822519U, PRIME3 = 3266489917U,
+                   PRIME4 = 668265263U, PRIME5 = 374761393U;
+    auto rotl = [](uint32_t x, int r) { return (x << r) | (x >> (32 - r)); };
+
+    uint32_t h = PRIME5 + static_cast<uint32_t>(len);
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4)
+    {
+        uint32_t v;
+        memcpy(&v, p + i, sizeof(v));
+        h = rotl(h + v * PRIME3, 17) * PRIME4;
+    }
+    for (; i < len; i++)
+        h = rotl(h + p[i] * PRIME5, 11) * PRIME1;
+
+    h ^= h >> 15;
+    h *= PRIME2;
+    h ^= h >> 13;
+    h *= PRIME3;
+    h ^= h >> 16;
+    return h;
+}
+
+std::string lz4_frame_compress(std::string_view input)
+{
+    std::string out;
+    out.reserve(input.size() / 2 + 16);
+
+    append_le32(out, LZ4_FRAME_MAGIC);
+    const uint8_t descriptor[2] = {LZ4_FLG_VERSION_01 | LZ4_FLG_BLOCK_INDEPENDENCE, LZ4_BD_BLOCK_MAX_SIZE_4MB};
+    out.append(reinterpret_cast<const char *>(descriptor), sizeof(descriptor));
+    out.push_back(static_cast<char>((xxh32_short(descriptor, sizeof(descriptor)) >> 8) & 0xFF));
+
+    for (size_t block_start = 0; block_start < input.size(); block_start += LZ4_BLOCK_MAX_SIZE)
+    {
+        const size_t block_len = std::min(LZ4_BLOCK_MAX_SIZE, input.size() - block_start);
+        const std::string block = lz4_block_compress(input.data() + block_start, block_len);
+
+        if (block.size() < block_len)
+        {
+            append_le32(out, block.size());
+            out.append(block);
+        }
+        else
+        {
+            // Incompressible data is stored as-is.
+            append_le32(out, block_len | LZ4_BLOCK_UNCOMPRESSED_FLAG);
+            out.append(input.data() + block_start, block_len);
+        }
+    }
+
+    append_le32(out, 0);  // EndMark
+
+    return out;
+}
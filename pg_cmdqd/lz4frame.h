@@ -0,0 +1,16 @@
+#ifndef LZ4FRAME_H
+#define LZ4FRAME_H
+
+#include <string>
+#include <string_view>
+
+/**
+ * Compress `input` into a standard LZ4 frame, as understood by `lz4 -d` and by the `cmdq.lz4_frame_decompress()`
+ * SQL function.
+ *
+ * This is a small, dependency-free implementation of the greedy LZ4 compressor, which trades some compression
+ * ratio for simplicity.  The frame consists of independent blocks of at most 4 MiB, without checksums.
+ */
+std::string lz4_frame_compress(std::string_view input);
+
+#endif // LZ4FRAME_H
@@ -0,0 +1,83 @@
+#include "memfdoutput.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+MemfdOutput::MemfdOutput(const char *name)
+    : _fd(memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING))
+{
+}
+
+MemfdOutput::~MemfdOutput()
+{
+    if (_addr != nullptr)
+        munmap(_addr, _size);
+}
+
+int MemfdOutput::fd() const
+{
+    return _fd.fd();
+}
+
+void MemfdOutput::map()
+{
+    if (_addr != nullptr or _copied)
+        return;
+
+    // A grandchild that outlives the command may still have the memfd open as its STDOUT or STDERR.  If it
+    // could shrink the file while we have it mapped, reading the mapping would get us a `SIGBUS`.
+    const bool sealed = fcntl(_fd.fd(), F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE) == 0;
+
+    struct stat st;
+    if (fstat(_fd.fd(), &st) < 0)
+        throw std::runtime_error(strerror(errno));
+
+    if (not sealed)
+    {
+        // Sealing with `F_SEAL_WRITE` fails (with `EBUSY`) while someone has a shared, writable mapping of the
+        // file.  Then we settle for a copy, which a concurrent `ftruncate()` can only make shorter.
+        _copy.resize(st.st_size);
+        size_t copied = 0;
+        while (copied < _copy.size())
+        {
+            const ssize_t n = pread(_fd.fd(), _copy.data() + copied, _copy.size() - copied, copied);
+            if (n < 0 and errno == EINTR)
+                continue;
+            if (n < 0)
+                throw std::runtime_error(strerror(errno));
+            if (n == 0)
+                break;
+            copied += n;
+        }
+        _copy.resize(copied);
+        _copied = true;
+        return;
+    }
+
+    if (st.st_size == 0)
+        return;  // `mmap()`ing 0 bytes is an error.
+
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, _fd.fd(), 0);
+    if (addr == MAP_FAILED)
+        throw std::runtime_error(strerror(errno));
+
+    _addr = addr;
+    _size = st.st_size;
+}
+
+std::string_view MemfdOutput::view() const
+{
+    if (_copied)
+        return _copy;
+
+    if (_addr == nullptr)
+        return std::string_view("", 0);  // Not a default `std::string_view`, of which `data()` is `nullptr`.
+
+    return std::string_view(static_cast<const char *>(_addr), _size);
+}
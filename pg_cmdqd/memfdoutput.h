@@ -0,0 +1,50 @@
+#ifndef MEMFDOUTPUT_H
+#define MEMFDOUTPUT_H
+
+#include <stddef.h>
+
+#include <string>
+#include <string_view>
+
+#include "fdguard.h"
+
+/**
+ * An anonymous, memory-backed file (see `memfd_create(2)`) that a command can write its output to directly,
+ * instead of to a pipe that we would have to keep reading from while the command runs.
+ *
+ * Once the command is done, `map()` seals the file against further changes and `mmap()`s the output, so that
+ * it can be passed on without being copied.  If the file can't be sealed, the output is copied after all.
+ */
+class MemfdOutput
+{
+    FdGuard _fd;
+    void *_addr = nullptr;
+    size_t _size = 0;
+    bool _copied = false;
+    std::string _copy;  // Instead of the mapping, when the file couldn't be sealed.
+
+public:
+    /**
+     * The constructor will throw a `std::runtime_error` when the memfd cannot be created.
+     */
+    MemfdOutput(const char *name);
+    ~MemfdOutput();
+
+    MemfdOutput(const MemfdOutput &) = delete;
+    MemfdOutput &operator=(const MemfdOutput &) = delete;
+
+    int fd() const;
+
+    /**
+     * Seal and map everything that has been written to the file so far; throws a `std::runtime_error` on
+     * failure.
+     */
+    void map();
+
+    /**
+     * The mapped output; empty if nothing was written, or if `map()` hasn't been called yet.
+     */
+    std::string_view view() const;
+};
+
+#endif // MEMFDOUTPUT_H
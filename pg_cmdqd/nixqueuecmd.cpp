@@ -2,28 +2,37 @@
 
 #include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <numeric>
 #include <iostream>
 #include <memory>
+#include <regex>
 #include <string>
 
 #include "pq-raii/libpq-raii.hpp"
 #include "cmdqueue.h"
 #include "fdguard.h"
+#include "lz4frame.h"
 #include "pipefds.h"
+#include "processlimits.h"
 #include "utils.h"
 
 #define CMDQD_PIPE_BUFFER_SIZE 512
 
+extern char **environ;
+
 const int GRACE_SECONDS_BETWEEN_SIGTERM_AND_SIGKILL = 1;
 
 /*
@@ -35,6 +44,8 @@ std::string NixQueueCmd::select::notify(const CmdQueue &cmd_queue)
 
 std::string NixQueueCmd::update_stmt(const std::shared_ptr<PG::conn> &conn)
 {
+    // The extra backslash in front of the `\x…` of the hex-format `bytea`s makes them independent of the
+    // `standard_conforming_strings` setting (which `PQescapeByteaConn()` used to take care of).
     return formatString(R"SQL(
 UPDATE
     %s
@@ -42,8 +53,8 @@ SET
     cmd_runtime = tstzrange(to_timestamp(%f), to_timestamp(%f))
     ,cmd_exit_code = %s
     ,cmd_term_sig = %s
-    ,cmd_stdout = '%s'
-    ,cmd_stderr = '%s'
+    ,cmd_stdout = E'\%s'
+    ,cmd_stderr = E'\%s'
 WHERE
     cmd_id = '%s'
     AND cmd_subid IS NOT DISTINCT from %s
@@ -53,66 +64,98 @@ WHERE
             meta.cmd_runtime_end,
             cmd_exit_code ? std::to_string(cmd_exit_code.value()).c_str() : "NULL",
             cmd_term_sig ? std::to_string(cmd_term_sig.value()).c_str() : "NULL",
-            PQ::escapeByteaConn(conn, cmd_stdout).c_str(),
-            PQ::escapeByteaConn(conn, cmd_stderr).c_str(),
+            PQ::as_hex_bytea(stdout_view()).c_str(),
+            PQ::as_hex_bytea(cmd_stderr).c_str(),
             meta.cmd_id.c_str(),
             meta.cmd_subid ? PQ::escapeLiteral(conn, meta.cmd_subid.value()).c_str() : "NULL"
         );
 }
 
-std::vector<std::optional<std::string>> NixQueueCmd::update_params() const
+void NixQueueCmd::bind_update_params(PG::params &params) const
 {
-    std::vector<std::optional<std::string>> params;
-    params.reserve(8);
-
-    params.push_back(meta.cmd_id);
-    params.push_back(meta.cmd_subid);
-    params.push_back(formatString("%f", meta.cmd_runtime_start));
-    params.push_back(formatString("%f", meta.cmd_runtime_end));
-    params.push_back(PQ::as_text(cmd_exit_code));
-    params.push_back(PQ::as_text(cmd_term_sig));
-    params.push_back(cmd_stdout);
-    params.push_back(cmd_stderr);
-
-    return params;
-}
+    params.bind_text(meta.cmd_id);
+    params.bind_text(meta.cmd_subid);
+    params.bind_printf("%f", meta.cmd_runtime_start);
+    params.bind_printf("%f", meta.cmd_runtime_end);
+    params.bind_integer(cmd_exit_code);
+    params.bind_integer(cmd_term_sig);
+    params.bind_binary(stdout_view());
+    params.bind_binary(cmd_stderr);
+
+    if (cmd_rusage)
+    {
+        const struct rusage &ru = cmd_rusage.value();
+#ifdef __APPLE__
+        const long maxrss_kib = ru.ru_maxrss / 1024;  // macOS reports bytes rather than KiB.
+#else
+        const long maxrss_kib = ru.ru_maxrss;
+#endif
+        params.bind_copy(PQ::as_text_composite_value({
+            formatString("%jd.%06ld seconds", (intmax_t) ru.ru_utime.tv_sec, (long) ru.ru_utime.tv_usec),
+            formatString("%jd.%06ld seconds", (intmax_t) ru.ru_stime.tv_sec, (long) ru.ru_stime.tv_usec),
+            std::to_string(maxrss_kib),
+            std::to_string(ru.ru_inblock),
+            std::to_string(ru.ru_oublock),
+            std::to_string(ru.ru_nvcsw),
+            std::to_string(ru.ru_nivcsw),
+        }));
+    }
+    else
+        params.bind_null();
 
-std::vector<int> NixQueueCmd::update_param_lengths() const
-{
-    return {-1, -1, -1, -1, -1, -1, (const int)this->cmd_stdout.length(), (const int)this->cmd_stderr.length()};
-}
+    params.bind_integer(cmd_stdout_bytes);
+    params.bind_integer(cmd_stderr_bytes);
 
-std::vector<int> NixQueueCmd::update_param_formats() const
-{
-    return {0, 0, 0, 0, 0, 0, 1, 1};
+    for (const std::optional<BlobStore::Ref> &blob : {cmd_stdout_blob, cmd_stderr_blob})
+    {
+        if (blob)
+        {
+            params.bind_copy(PQ::as_text_composite_value({
+                "\\x" + blob->sha256_hex,
+                std::to_string(blob->size),
+                blob->path,
+            }));
+        }
+        else
+            params.bind_null();
+    }
 }
 
-NixQueueCmd::NixQueueCmd(
-        const PG::result &result,
-        int row_number,
-        const std::unordered_map<std::string, int> &field_numbers
-    ) noexcept
-    : meta(result, row_number, field_numbers)
+NixQueueCmd::NixQueueCmd(const PG::row &row, const ColumnNumbers &columns) noexcept
+    : meta(row, columns.head<QueueCmdMetadata::COLUMNS.size()>())
 {
     try
     {
-        if (PQgetisnull(result.get(), row_number, field_numbers.at("cmd_argv")))
+        const int cmd_argv_field = columns[CMD_ARGV];
+        if (row.isnull(cmd_argv_field))
         {
             throw std::domain_error("`cmd_argv` should never be `NULL`.");
         }
-        std::string raw_cmd_argv = PQgetvalue(result.get(), row_number, field_numbers.at("cmd_argv"));
-        cmd_argv = PQ::from_text_array(raw_cmd_argv);
+        const std::string_view raw_cmd_argv = row.value(cmd_argv_field);
+        if (row.format(cmd_argv_field) == 1)
+            cmd_argv = PQ::from_binary_array(raw_cmd_argv.data(), raw_cmd_argv.size());
+        else
+            cmd_argv = PQ::from_text_array(raw_cmd_argv);
 
-        if (PQgetisnull(result.get(), row_number, field_numbers.at("cmd_env")))
+        const int cmd_env_field = columns[CMD_ENV];
+        if (row.isnull(cmd_env_field))
         {
             throw std::domain_error("`cmd_env` should never be `NULL`.");
         }
-        std::string raw_cmd_env = PQgetvalue(result.get(), row_number, field_numbers.at("cmd_env"));
-        cmd_env = throw_if_missing_any_value(PQ::from_text_hstore(raw_cmd_env));
+        const std::string_view raw_cmd_env = row.value(cmd_env_field);
+        if (row.format(cmd_env_field) == 1)
+            cmd_env = throw_if_missing_any_value(PQ::from_binary_hstore(raw_cmd_env.data(), raw_cmd_env.size()));
+        else
+            cmd_env = throw_if_missing_any_value(PQ::from_text_hstore(raw_cmd_env));
 
         // For `cmd_stdin`, we can ignore NULLness, because `PGgetvalue()` returns an empty string when the
         // field is `NULL`, which is what we'd want anyway.
-        cmd_stdin = PQgetvalue(result.get(), row_number, field_numbers.at("cmd_stdin"));
+        const int cmd_stdin_field = columns[CMD_STDIN];
+        const std::string_view raw_cmd_stdin = row.value(cmd_stdin_field);
+        if (row.format(cmd_stdin_field) == 1)
+            cmd_stdin = PQ::from_binary_bytea(raw_cmd_stdin.data(), raw_cmd_stdin.size());
+        else
+            cmd_stdin = PQ::from_text_bytea(raw_cmd_stdin);
 
         _is_valid = true;
     }
@@ -143,6 +186,13 @@ NixQueueCmd::~NixQueueCmd()
 {
 }
 
+std::string_view NixQueueCmd::stdout_view() const
+{
+    if (stdout_memfd)
+        return stdout_memfd->view();
+    return cmd_stdout;
+}
+
 std::string NixQueueCmd::cmd_line() const
 {
     // TODO: Proper bash escaping
@@ -160,37 +210,48 @@ std::string NixQueueCmd::cmd_line() const
     return line;
 }
 
-bool NixQueueCmd::cmd_succeeded() const
+std::vector<std::string> NixQueueCmd::base_env()
 {
-    return cmd_exit_code.has_value() and cmd_exit_code.value() == 0;
+    const char *path = getenv("PATH");
+    if (path == nullptr)
+        return {};
+    return {std::string("PATH=") + path};
 }
 
-void NixQueueCmd::flush_stderr(LogLevel level, bool flush_on_end)
+std::vector<std::string> NixQueueCmd::env_strings(const std::vector<std::string> &base_env) const
 {
-    std::string_view v = std::string_view(cmd_stderr).substr(flush_stderr_pos, cmd_stderr.size());
+    std::vector<std::string> env;
+    env.reserve(base_env.size() + cmd_env.size());
 
-    std::string line;
-    for (char c : v)
+    for (const std::string &var : base_env)
     {
-        if (c == '\n' || c == '\r')
-        {
-            if (!line.empty())
-                logger->log(level, line.c_str());
-            line.clear();
-        }
-        else
-        {
-            line.push_back(c);
-        }
-
-        flush_stderr_pos++;
+        // Variables from the `cmd_env` take precedence.
+        if (cmd_env.count(var.substr(0, var.find('='))) == 0)
+            env.push_back(var);
     }
+    for (const std::pair<const std::string, std::string> &var : cmd_env)
+        env.push_back(var.first + "=" + var.second);
+
+    return env;
+}
+
+bool NixQueueCmd::cmd_succeeded() const
+{
+    return cmd_exit_code.has_value() and cmd_exit_code.value() == 0;
+}
+
+void NixQueueCmd::flush_stderr(LogLevel level, bool flush_on_end)
+{
+    // The line is passed as an argument rather than as the format string, because it may well contain `%`s.
+    auto log_line = [this, level](std::string_view line) {
+        logger->log(level, "%.*s", (int)line.size(), line.data());
+    };
 
     // On exit you also want lines ending without newline, but while running, it may be incomplete data.
-    if (flush_on_end && !line.empty())
-    {
-        logger->log(level, line.c_str());
-    }
+    if (flush_on_end)
+        stderr_lines.finish(cmd_stderr, log_line);
+    else
+        stderr_lines.feed(cmd_stderr, log_line);
 }
 
 /*
@@ -203,33 +264,361 @@ void NixQueueCmd::_run_forked_child_logic()
 }
 */
 
-void sigchld_handler(int _)
+static int pidfd_open(pid_t pid)
+{
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+/**
+ * Make `timer_fd` expire (once) after `seconds` from now, on the monotonic clock.
+ */
+static void arm_timer(int timer_fd, double seconds)
+{
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = static_cast<time_t>(seconds);
+    spec.it_value.tv_nsec = static_cast<long>((seconds - spec.it_value.tv_sec) * 1000000000);
+    if (spec.it_value.tv_sec == 0 and spec.it_value.tv_nsec == 0)
+        spec.it_value.tv_nsec = 1;  // An all-zero `it_value` would disarm the timer instead.
+    timerfd_settime(timer_fd, 0, &spec, nullptr);
+}
+
+/**
+ * `write()` to a pipe without risking a `SIGPIPE`, which would take down the whole daemon, when the reading
+ * end has been closed.  `SIGPIPE` is blocked in this thread during the `write()`, which then fails with
+ * `EPIPE` instead, and the pending signal is discarded.
+ */
+static ssize_t write_without_sigpipe(int fd, const void *buf, size_t count)
+{
+    sigset_t sigpipe_mask, old_sig_mask;
+    sigemptyset(&sigpipe_mask);
+    sigaddset(&sigpipe_mask, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe_mask, &old_sig_mask);
+
+    ssize_t bytes_written = write(fd, buf, count);
+    int write_errno = errno;
+
+    if (bytes_written < 0 and write_errno == EPIPE)
+    {
+        const struct timespec no_wait = {0, 0};
+        sigtimedwait(&sigpipe_mask, nullptr, &no_wait);
+    }
+    pthread_sigmask(SIG_SETMASK, &old_sig_mask, nullptr);
+
+    errno = write_errno;
+    return bytes_written;
+}
+
+bool NixQueueCmd::runs_in_worker(const CmdQueue &cmd_queue) const
 {
+    const std::vector<std::string> &prefix = cmd_queue.queue_worker_argv;
+
+    if (prefix.empty() or cmd_argv.size() < prefix.size())
+        return false;
+    return std::equal(prefix.begin(), prefix.end(), cmd_argv.begin());
 }
 
-void NixQueueCmd::run_cmd(std::shared_ptr<PG::conn> &conn, const double queue_cmd_timeout_sec)
+void NixQueueCmd::run_cmd_in_worker(const CmdQueue &cmd_queue, RunnerState &runner_state)
 {
-    static bool sigchld_handler_is_set = false;
-    if (not sigchld_handler_is_set)
+    const double queue_cmd_timeout_sec = cmd_queue.queue_cmd_timeout_sec;
+    std::unique_ptr<NixQueueWorker> &worker = runner_state.worker;
+
+    if (worker)
     {
-        // We will set up a dummy signal handler function for `SIGCHLD`, because all we really want is for
-        // `poll()` to return when the child process exits.
-        struct sigaction sigchld_action;
-        sigemptyset(&sigchld_action.sa_mask);
-        sigchld_action.sa_handler = sigchld_handler;
-        sigchld_action.sa_flags = 0;
-        sigaction(SIGCHLD, &sigchld_action, nullptr);
-        sigchld_handler_is_set = true;
+        std::optional<int> idle_wstatus = worker->try_reap();
+        if (idle_wstatus)
+        {
+            logger->log(LOG_WARNING, "Worker died while idle (wait status %i); starting a new one.",
+                        idle_wstatus.value());
+            worker.reset();
+        }
     }
 
+    if (not worker)
+    {
+        try
+        {
+            worker = std::make_unique<NixQueueWorker>(
+                    cmd_queue.queue_worker_argv, runner_state.base_env, ProcessLimits(cmd_queue));
+        }
+        catch (const std::runtime_error &ex)
+        {
+            logger->log(LOG_ERROR, "Could not start worker: %s", ex.what());
+            this->cmd_stderr = formatString("Could not start worker: %s\n", ex.what());
+            this->cmd_term_sig = SIGABRT;
+            return;
+        }
+    }
+
+    const pid_t worker_pid = worker->pid();
+
     logger->log(
-        LOG_INFO, "cmd_id = '%s'%s: \x1b[1m%s\x1b[22m",
+        LOG_DEBUG4, "cmd_id = '%s'%s: handing over to worker PID = \x1b[1m%jd\x1b[22m",
         meta.cmd_id.c_str(),
         meta.cmd_subid ? std::string(" (cmd_subid = '" + meta.cmd_subid.value() + "')").c_str() : "",
-        cmd_line().c_str()
+        (intmax_t) worker_pid
     );
 
-    PipeFds stdin_fds, stdout_fds, stderr_fds;
+    const std::vector<std::string> argv_tail(cmd_argv.begin() + cmd_queue.queue_worker_argv.size(), cmd_argv.end());
+    const std::string request = NixQueueWorker::encode_request(argv_tail, cmd_env, cmd_stdin);
+    std::string::size_type request_bytes_written = 0;
+
+    std::string reply;
+    std::optional<uint32_t> reply_length;
+    char reply_buf[CMDQD_PIPE_BUFFER_SIZE];
+
+    // The reply carries the command's output in full, so without this cap, the limits on what we keep of that
+    // output would only be applied after having buffered all of it.  Without limits, it's the length prefix of
+    // the reply that we would have to trust, up to 4 GiB.
+    const size_t max_reply_length
+        = NixQueueWorker::REPLY_OVERHEAD_BYTES
+          + std::min(cmd_queue.queue_max_stdout_bytes.value_or(NixQueueWorker::MAX_REPLY_STREAM_BYTES),
+                     NixQueueWorker::MAX_REPLY_STREAM_BYTES)
+          + std::min(cmd_queue.queue_max_stderr_bytes.value_or(NixQueueWorker::MAX_REPLY_STREAM_BYTES),
+                     NixQueueWorker::MAX_REPLY_STREAM_BYTES);
+
+    bool tried_sigterm = false;
+
+    // Set when the worker has died (or has been killed by us) before having replied in full.
+    std::optional<int> wstatus;
+
+    std::optional<FdGuard> timer_fd;
+    try
+    {
+        timer_fd.emplace(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+    }
+    catch (const std::runtime_error &ex)
+    {
+        this->cmd_stderr = formatString("timerfd_create() error: %s\n", ex.what());
+        this->cmd_term_sig = SIGABRT;
+        return;
+    }
+    if (queue_cmd_timeout_sec > 0)
+        arm_timer(timer_fd->fd(), queue_cmd_timeout_sec);
+
+    while (true)
+    {
+        struct pollfd fds[] = {
+            { request_bytes_written < request.size() ? worker->stdin_fd() : -1, POLLOUT, 0 },
+            { worker->stdout_fd(), POLLIN, 0 },
+            { timer_fd->fd(), POLLIN, 0 },
+        };
+
+        int fd_count = poll(fds, 3, -1);
+        if (fd_count < 0)
+        {
+            if (errno == EINTR) continue;
+
+            this->cmd_stderr = formatString("poll() error: %s", strerror(errno));
+            this->cmd_term_sig = SIGABRT;
+            worker->kill_and_reap(SIGKILL);
+            worker.reset();
+            return;
+        }
+
+        if (fds[2].revents & POLLIN)
+        {
+            uint64_t expirations;
+            while (read(timer_fd->fd(), &expirations, sizeof(expirations)) < 0 and errno == EINTR) {}
+
+            if (not tried_sigterm)
+            {
+                logger->log(
+                        LOG_ERROR,
+                        "queue_cmd_timeout of %fsec exceeded; sending SIGTERM signal to worker PID %i",
+                        queue_cmd_timeout_sec,
+                        worker_pid);
+                kill(-worker_pid, SIGTERM);
+                tried_sigterm = true;
+                arm_timer(timer_fd->fd(), GRACE_SECONDS_BETWEEN_SIGTERM_AND_SIGKILL);
+            }
+            else
+            {
+                logger->log(
+                        LOG_ERROR,
+                        "We tried to kill worker PID %i gently, %i seconds ago; now we will SIGKILL it.",
+                        worker_pid,
+                        GRACE_SECONDS_BETWEEN_SIGTERM_AND_SIGKILL);
+                wstatus = worker->kill_and_reap(SIGKILL);
+                break;
+            }
+        }
+
+        if (fds[0].revents != 0)
+        {
+            ssize_t request_bytes = write_without_sigpipe(worker->stdin_fd(),
+                                                          request.data() + request_bytes_written,
+                                                          request.size() - request_bytes_written);
+            if (request_bytes >= 0)
+            {
+                request_bytes_written += request_bytes;
+            }
+            else if (errno == EPIPE)
+            {
+                // The worker is gone; we will learn how it died once we've read the EOF on its STDOUT.
+                request_bytes_written = request.size();
+            }
+            else if (errno != EINTR and errno != EAGAIN)
+            {
+                this->cmd_stderr = formatString("Error during write() to worker STDIN: %s", strerror(errno));
+                this->cmd_term_sig = SIGABRT;
+                worker->kill_and_reap(SIGKILL);
+                worker.reset();
+                return;
+            }
+        }
+
+        if (fds[1].revents != 0)
+        {
+            bool worker_closed_stdout = false;
+            ssize_t reply_bytes = 0;
+            while ((reply_bytes = read(worker->stdout_fd(), reply_buf, CMDQD_PIPE_BUFFER_SIZE)) > 0)
+            {
+                reply.append(reply_buf, reply_bytes);
+
+                if (not reply_length)
+                    reply_length = NixQueueWorker::frame_length(reply);
+                if (reply_length and reply_length.value() > max_reply_length)
+                    break;
+            }
+            if (reply_length and reply_length.value() > max_reply_length)
+            {
+                logger->log(LOG_ERROR, "Worker PID %jd announced a reply of %ju bytes; rejecting it.",
+                            (intmax_t) worker_pid, (uintmax_t) reply_length.value());
+                this->cmd_stdout = "";
+                this->cmd_stderr = formatString(
+                        "Worker PID %jd announced a reply of %ju bytes, which exceeds the %zu bytes that"
+                        " queue_max_stdout_bytes and queue_max_stderr_bytes (or, without them, 1 GiB each)"
+                        " allow for.\n",
+                        (intmax_t) worker_pid, (uintmax_t) reply_length.value(), max_reply_length);
+                this->cmd_term_sig = SIGABRT;
+                worker->kill_and_reap(SIGKILL);
+                worker.reset();
+                return;
+            }
+            if (reply_bytes == 0)
+            {
+                worker_closed_stdout = true;
+            }
+            else if (errno != EAGAIN and errno != EINTR)
+            {
+                this->cmd_stderr = formatString("Error during read() from worker STDOUT: %s", strerror(errno));
+                this->cmd_term_sig = SIGABRT;
+                worker->kill_and_reap(SIGKILL);
+                worker.reset();
+                return;
+            }
+
+            if (reply_length and reply.size() >= sizeof(uint32_t) + reply_length.value())
+                break;
+
+            if (worker_closed_stdout)
+            {
+                // Without a STDOUT, the worker is of no more use to us, even if it's still alive.
+                wstatus = worker->kill_and_reap(SIGKILL);
+                break;
+            }
+        }
+    }
+
+    if (wstatus)
+    {
+        worker.reset();
+
+        if (WIFEXITED(wstatus.value()) and WEXITSTATUS(wstatus.value()) != 0)
+            this->cmd_exit_code = WEXITSTATUS(wstatus.value());
+        else if (WIFSIGNALED(wstatus.value()))
+            this->cmd_term_sig = WTERMSIG(wstatus.value());
+        else
+            this->cmd_term_sig = SIGABRT;  // The worker exited cleanly, but without replying.
+        this->cmd_stderr += formatString("Worker PID %jd died before replying in full.\n", (intmax_t) worker_pid);
+        return;
+    }
+
+    try
+    {
+        if (reply.size() != sizeof(uint32_t) + reply_length.value())
+            throw std::runtime_error("Worker wrote more than one reply.");
+
+        int exit_code;
+        std::string_view reply_stdout, reply_stderr;
+        NixQueueWorker::decode_reply(std::string_view(reply).substr(sizeof(uint32_t)),
+                                     exit_code, reply_stdout, reply_stderr);
+        this->cmd_exit_code = exit_code;
+
+        stdout_bounds.append(cmd_stdout, reply_stdout.data(), reply_stdout.size());
+        stderr_bounds.append(cmd_stderr, reply_stderr.data(), reply_stderr.size());
+        stdout_bounds.finish(cmd_stdout);
+        stderr_bounds.finish(cmd_stderr);
+    }
+    catch (const std::runtime_error &ex)
+    {
+        logger->log(LOG_ERROR, "Protocol error from worker PID %jd: %s", (intmax_t) worker_pid, ex.what());
+        this->cmd_stdout = "";
+        this->cmd_stderr = formatString("Protocol error from worker PID %jd: %s\n", (intmax_t) worker_pid, ex.what());
+        this->cmd_term_sig = SIGABRT;
+        worker->kill_and_reap(SIGKILL);
+        worker.reset();
+        return;
+    }
+
+    flush_stderr(LogLevel::LOG_NOTICE, true);
+
+    worker->count_cmd();
+    if (tried_sigterm
+        or (cmd_queue.queue_worker_max_cmds and worker->cmds_run() >= cmd_queue.queue_worker_max_cmds.value()))
+    {
+        worker.reset();  // `~NixQueueWorker()` retires the worker.
+    }
+}
+
+void NixQueueCmd::run_cmd_in_child(const CmdQueue &cmd_queue, RunnerState &runner_state)
+{
+    const double queue_cmd_timeout_sec = cmd_queue.queue_cmd_timeout_sec;
+
+    PipeFds stdin_fds;
+
+    // The STDOUT and STDERR go either through pipes that we keep reading while the command runs, or into
+    // memfds that we only have to look at once the command has exited.
+    std::optional<PipeFds> stdout_fds, stderr_fds;
+    std::unique_ptr<MemfdOutput> stderr_memfd;
+    if (cmd_queue.queue_output_capture == "memfd")
+    {
+        try
+        {
+            stdout_memfd = std::make_unique<MemfdOutput>("cmd_stdout");
+            stderr_memfd = std::make_unique<MemfdOutput>("cmd_stderr");
+        }
+        catch (const std::runtime_error &ex)
+        {
+            logger->log(LOG_ERROR, "memfd_create() error: %s", ex.what());
+            stdout_memfd.reset();
+            this->cmd_stderr = formatString("memfd_create() error: %s\n", ex.what());
+            this->cmd_term_sig = SIGABRT;
+            return;
+        }
+    }
+    else
+    {
+        stdout_fds.emplace();
+        stderr_fds.emplace();
+    }
+    const int child_stdout_fd = stdout_memfd ? stdout_memfd->fd() : stdout_fds->write_fd();
+    const int child_stderr_fd = stderr_memfd ? stderr_memfd->fd() : stderr_fds->write_fd();
+
+    // Prepare everything that the child process needs for `exec()`ing before we `fork()`, so that the child
+    // doesn't need to allocate or fiddle with its environment.
+    const std::vector<std::string> env = env_strings(runner_state.base_env);
+    std::vector<char *> envp = c_str_array(env);
+    std::vector<char *> argv = c_str_array(cmd_argv);
+
+    std::optional<std::string> executable;
+    for (const std::string &var : env)
+    {
+        if (var.compare(0, 5, "PATH=") == 0)
+            executable = runner_state.executables.resolve(cmd_argv[0], var.substr(5));
+    }
+    const ProcessLimits limits(cmd_queue);
 
     // We temporarily mask signals that are normally sent to the whole process _group_, until we've done
     // a successful fork and detached the child process from our process group.  This way, we can keep
@@ -254,12 +643,13 @@ void NixQueueCmd::run_cmd(std::shared_ptr<PG::conn> &conn, const double queue_cm
     {
         // Close the end of each pipe that we won't need in the child process
         stdin_fds.close_write_fd();
-        stdout_fds.close_read_fd();
-        stderr_fds.close_read_fd();
+        if (stdout_fds) stdout_fds->close_read_fd();
+        if (stderr_fds) stderr_fds->close_read_fd();
 
+        // `dup2()` doesn't copy the `FD_CLOEXEC` flag with which the memfds were created.
         while ((dup2(stdin_fds.read_fd(), STDIN_FILENO) == -1) && (errno == EINTR)) {}
-        while ((dup2(stdout_fds.write_fd(), STDOUT_FILENO) == -1) && (errno == EINTR)) {}
-        while ((dup2(stderr_fds.write_fd(), STDERR_FILENO) == -1) && (errno == EINTR)) {}
+        while ((dup2(child_stdout_fd, STDOUT_FILENO) == -1) && (errno == EINTR)) {}
+        while ((dup2(child_stderr_fd, STDERR_FILENO) == -1) && (errno == EINTR)) {}
 
         // Brute force close any open file/socket, because we don't want the child to see them.
         struct rlimit rlim;
@@ -273,6 +663,16 @@ void NixQueueCmd::run_cmd(std::shared_ptr<PG::conn> &conn, const double queue_cm
             exit(128);  // Arbitrarily chosen exit code.
         }
 
+        // The limits are only applied now, so that a low `RLIMIT_NOFILE` doesn't keep us from closing all the
+        // FDs above.
+        const char *failed_call = limits.apply();
+        if (failed_call)
+        {
+            const int limits_errno = errno;
+            std::cerr << failed_call << " error: " << strerror(limits_errno) << std::endl;
+            exit(128);
+        }
+
         // Now that we've detached ourselves from our parent process group, we can safely restore the default
         // signal mask—the `exec*()` functions will already restore the default signal _handlers_—without us
         // risking to receive signals intended for our parent process (`pg_cmdqd`).
@@ -280,25 +680,21 @@ void NixQueueCmd::run_cmd(std::shared_ptr<PG::conn> &conn, const double queue_cm
         sigemptyset(&empty_sigset);
         sigprocmask(SIG_SETMASK, &empty_sigset, nullptr);
 
-        std::vector<char *> argv_heads;
-        argv_heads.reserve(this->cmd_argv.size() + 1);
-        for (const std::string &s : cmd_argv)
-            argv_heads.push_back(const_cast<char*>(s.c_str()));
-        argv_heads.push_back(nullptr);
-        char **c_argv = argv_heads.data();
-        // We don't have to worry about cleaning up c_argv, because execvp() will clear up all that.
-
-        std::string path(getenv("PATH"));
-        clearenv();
-        setenv("PATH", path.c_str(), 1);
-        for (const std::pair<const std::string, std::string> &var : this->cmd_env)
-        {
-            setenv(var.first.c_str(), var.second.c_str(), 1);
-        }
-
-        execvp(this->cmd_argv[0].c_str(), c_argv);
-
-        // We only get here if the call to `execvp()` fails.
+        if (executable)
+            execve(executable.value().c_str(), argv.data(), envp.data());
+
+        // If the executable was not found in the `ExecutableCache`, or if `execve()` failed (with `ENOEXEC` for
+        // a script without shebang, for example), we leave the searching and the error reporting to
+        // `execvpe()`.  It looks up the executable in the `PATH` of the _current_ environment, which should be
+        // the one from the `cmd_env` if that has a `PATH`.
+        environ = envp.data();
+#ifdef _GNU_SOURCE
+        execvpe(argv[0], argv.data(), envp.data());
+#else
+        execvp(argv[0], argv.data());
+#endif
+
+        // We only get here if the call to `execvpe()` fails.
         std::cerr << strerror(errno) << std::endl;
         exit(127);  // Same as when bash can't find a command.
     }
@@ -333,60 +729,59 @@ void NixQueueCmd::run_cmd(std::shared_ptr<PG::conn> &conn, const double queue_cm
 
     // Close the end of each pipe that we won't need in the parent process
     stdin_fds.close_read_fd();
-    stdout_fds.close_write_fd();
-    stderr_fds.close_write_fd();
+    if (stdout_fds) stdout_fds->close_write_fd();
+    if (stderr_fds) stderr_fds->close_write_fd();
 
     // Make the parent ends of the pipes non-blocking
     fcntl(stdin_fds.write_fd(), F_SETFL, fcntl(stdin_fds.write_fd(), F_GETFL) | O_NONBLOCK);
-    fcntl(stdout_fds.read_fd(), F_SETFL, fcntl(stdout_fds.read_fd(), F_GETFL) | O_NONBLOCK);
-    fcntl(stderr_fds.read_fd(), F_SETFL, fcntl(stderr_fds.read_fd(), F_GETFL) | O_NONBLOCK);
+    if (stdout_fds)
+        fcntl(stdout_fds->read_fd(), F_SETFL, fcntl(stdout_fds->read_fd(), F_GETFL) | O_NONBLOCK);
+    if (stderr_fds)
+        fcntl(stderr_fds->read_fd(), F_SETFL, fcntl(stderr_fds->read_fd(), F_GETFL) | O_NONBLOCK);
+
+    // Instead of being woken up by `SIGCHLD` and having to `waitpid()` to find out whether it was our child
+    // that exited, we `poll()` a pidfd, which becomes readable when the child has exited.  The timeout is
+    // kept by a timer on the monotonic clock, so that changes to the system time can't affect it.
+    std::optional<FdGuard> pid_fd;
+    std::optional<FdGuard> timer_fd;
+    try
+    {
+        pid_fd.emplace(pidfd_open(pid));
+        timer_fd.emplace(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+    }
+    catch (const std::runtime_error &ex)
+    {
+        logger->log(LOG_ERROR, "Could not set up the supervision of PID %i: %s", pid, ex.what());
+        kill(-pid, SIGKILL);
+        while (waitpid(pid, nullptr, 0) < 0 and errno == EINTR) {}
+        this->cmd_stderr = formatString("Could not set up the supervision of PID %i: %s\n", pid, ex.what());
+        this->cmd_term_sig = SIGABRT;
+        return;
+    }
+
+    if (queue_cmd_timeout_sec > 0)
+        arm_timer(timer_fd->fd(), queue_cmd_timeout_sec);
 
     struct pollfd fds[] = {
         { stdin_fds.write_fd(), static_cast<short>((cmd_stdin.empty() ? 0 : POLLOUT) | POLLHUP | POLLERR), 0 },
-        { stdout_fds.read_fd(), POLLIN | POLLHUP | POLLERR, 0 },
-        { stderr_fds.read_fd(), POLLIN | POLLHUP | POLLERR, 0 },
+        // `poll()` ignores the negative FDs that we have instead of pipes when capturing into memfds.
+        { stdout_fds ? stdout_fds->read_fd() : -1, POLLIN | POLLHUP | POLLERR, 0 },
+        { stderr_fds ? stderr_fds->read_fd() : -1, POLLIN | POLLHUP | POLLERR, 0 },
+        { pid_fd->fd(), POLLIN, 0 },
+        { timer_fd->fd(), POLLIN, 0 },
     };
 
     char stdout_buf[CMDQD_PIPE_BUFFER_SIZE];
     char stderr_buf[CMDQD_PIPE_BUFFER_SIZE];
     ssize_t cum_stdin_bytes_written = 0;
     bool tried_sigterm = false;
-    double sigterm_time = 0;
-
-    int wstatus;
-    int res_pid = 0;
-    bool reaped = false;
+    bool exited = false;
 
     while (true)
     {
-        double now = QueueCmdMetadata::unix_timestamp();
-        int poll_timeout = 0;
-
-        if (!reaped && (res_pid = waitpid(pid, &wstatus, WNOHANG)) != 0)
-        {
-            if (res_pid < 0)
-                break;
-            if (res_pid > 0)
-                reaped = true;
-        }
-
-        if (reaped)
-        {
-            poll_timeout = 0;
-        }
-        else if (queue_cmd_timeout_sec == 0)
-        {
-            poll_timeout = -1;
-        }
-        else
-        {
-            poll_timeout = (queue_cmd_timeout_sec
-                            - (now - meta.cmd_runtime_start)
-                            + (tried_sigterm ? GRACE_SECONDS_BETWEEN_SIGTERM_AND_SIGKILL : 0)) * 1000;
-            if (poll_timeout < 0)
-                poll_timeout = 0;
-        }
-        int fd_count = poll(fds, 3, poll_timeout);
+        // Once the child has exited, we only collect what's left in its pipes, without waiting for any
+        // (grand)children that it may have left behind holding the pipes open.
+        int fd_count = poll(fds, 5, exited ? 0 : -1);
         if (fd_count < 0)
         {
             if (errno == EINTR) continue;
@@ -396,152 +791,173 @@ void NixQueueCmd::run_cmd(std::shared_ptr<PG::conn> &conn, const double queue_cm
             break;
         }
         if (fd_count == 0)
+            break;  // Only possible once the child has exited.
+
+        logger->log(LOG_DEBUG5, "fds[].revents: %i, %i, %i, %i, %i",
+                    fds[0].revents, fds[1].revents, fds[2].revents, fds[3].revents, fds[4].revents);
+
+        if (fds[4].revents & POLLIN)
         {
-            if (reaped)
-                break;
+            uint64_t expirations;
+            while (read(timer_fd->fd(), &expirations, sizeof(expirations)) < 0 and errno == EINTR) {}
 
-            now = QueueCmdMetadata::unix_timestamp();
-            if (now - meta.cmd_runtime_start >= queue_cmd_timeout_sec)
+            // Have we tried it friendly already?
+            if (not tried_sigterm)
             {
-                // Have we tried it friendly already?
-                if (tried_sigterm)
-                {
-                    // And given the cmd a second to shutdown gracefully?
-                    if ((now - sigterm_time) > GRACE_SECONDS_BETWEEN_SIGTERM_AND_SIGKILL)
-                    {
-                        logger->log(
-                                LOG_ERROR,
-                                "We tried to kill PID %i gently, %f seconds ago; now we will SIGKILL it.",
-                                pid,
-                                now - sigterm_time);
-                        kill(pid, SIGKILL);  // `kill -9`
-                        res_pid = waitpid(pid, &wstatus, 0);
-                        break;
-                    }
-                }
-                else
-                {
-                    logger->log(
-                            LOG_ERROR,
-                            "queue_cmd_timeout of %fsec exceeded; sending SIGTERM signal to PID %i",
-                            queue_cmd_timeout_sec,
-                            pid);
-                    kill(pid, SIGTERM);
-                    tried_sigterm = true;
-                    sigterm_time = now;
-                }
+                logger->log(
+                        LOG_ERROR,
+                        "queue_cmd_timeout of %fsec exceeded; sending SIGTERM signal to process group %i",
+                        queue_cmd_timeout_sec,
+                        pid);
+                kill(-pid, SIGTERM);
+                tried_sigterm = true;
+                arm_timer(timer_fd->fd(), GRACE_SECONDS_BETWEEN_SIGTERM_AND_SIGKILL);
+            }
+            else
+            {
+                logger->log(
+                        LOG_ERROR,
+                        "We tried to kill process group %i gently, %i seconds ago; now we will SIGKILL it.",
+                        pid,
+                        GRACE_SECONDS_BETWEEN_SIGTERM_AND_SIGKILL);
+                kill(-pid, SIGKILL);  // `kill -9`
             }
-        } // if (fd_count == 0)
-        if (fd_count > 0)
+        }
+        if (fds[3].revents & POLLIN)
         {
-            logger->log(LOG_DEBUG5, "fds[].revents: %i, %i, %i", fds[0].revents, fds[1].revents, fds[2].revents);
+            exited = true;
+            fds[3].fd = -1;
+            fds[4].fd = -1;
+        }
 
-            if (fds[0].revents & POLLOUT)
+        if (fds[0].revents & POLLOUT)
+        {
+            logger->log(LOG_DEBUG5, "cmd STDIN ready for write()");
+            bool write_to_stdin_erred = false;
+            while (cum_stdin_bytes_written < (ssize_t)cmd_stdin.length())
             {
-                logger->log(LOG_DEBUG5, "cmd STDIN ready for write()");
-                bool write_to_stdin_erred = false;
-                while (cum_stdin_bytes_written < (ssize_t)cmd_stdin.length())
+                ssize_t stdin_bytes_written = write_without_sigpipe(
+                    stdin_fds.write_fd(),
+                    this->cmd_stdin.c_str()+cum_stdin_bytes_written,
+                    this->cmd_stdin.length()-cum_stdin_bytes_written
+                );
+                if (stdin_bytes_written < 0)
                 {
-                    //logger->log(LOG_DEBUG5, "Let's write() %i bytes TO STDIN", this->cmd_stdin.length()-cum_stdin_bytes_written);
-                    ssize_t stdin_bytes_written = write(
-                        stdin_fds.write_fd(),
-                        this->cmd_stdin.c_str()+cum_stdin_bytes_written,
-                        this->cmd_stdin.length()-cum_stdin_bytes_written
-                    );
-                    if (stdin_bytes_written < 0)
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN) break;  // The pipe is full; wait for the next `POLLOUT`.
+                    if (errno == EPIPE)
                     {
-                        if (errno == EINTR) continue;
-                        this->cmd_stderr = formatString("Error during write() to cmd STDIN: %s", strerror(errno));
-                        this->cmd_term_sig = SIGABRT;
-                        write_to_stdin_erred = true;
+                        // The command closed its STDIN without reading all of it.  That's its prerogative.
+                        cum_stdin_bytes_written = cmd_stdin.length();
                         break;
                     }
-                    cum_stdin_bytes_written += stdin_bytes_written;
-                }
-                if (write_to_stdin_erred) break;
-                if (cum_stdin_bytes_written == (ssize_t)cmd_stdin.length())
-                {
-                    stdin_fds.close_write_fd();
-                    fds[0].fd = -1;
-                    fds[0].events = 0;
-                }
-            }
-            if (fds[1].revents & POLLIN)
-            {
-                logger->log(LOG_DEBUG5, "cmd STDOUT ready for read()");
-                ssize_t stdout_bytes_read = 0;
-                while ((stdout_bytes_read = read(stdout_fds.read_fd(), stdout_buf, CMDQD_PIPE_BUFFER_SIZE)) > 0)
-                {
-                    this->cmd_stdout += std::string(stdout_buf, stdout_bytes_read);
-                }
-                if (stdout_bytes_read < 0 and errno != EAGAIN)
-                {
-                    this->cmd_stderr = formatString("Error during read() from cmd STDOUT: %s", strerror(errno));
+                    this->cmd_stderr = formatString("Error during write() to cmd STDIN: %s", strerror(errno));
                     this->cmd_term_sig = SIGABRT;
+                    write_to_stdin_erred = true;
                     break;
                 }
+                cum_stdin_bytes_written += stdin_bytes_written;
             }
-            if (fds[2].revents & POLLIN)
+            if (write_to_stdin_erred) break;
+            if (cum_stdin_bytes_written == (ssize_t)cmd_stdin.length())
             {
-                logger->log(LOG_DEBUG5, "cmd STDERR ready for read()");
-                ssize_t stderr_bytes_read = 0;
-                while ((stderr_bytes_read = read(stderr_fds.read_fd(), stderr_buf, CMDQD_PIPE_BUFFER_SIZE)) > 0)
-                {
-                    this->cmd_stderr += std::string(stderr_buf, stderr_bytes_read);
-                }
-                if (stderr_bytes_read < 0 and errno != EAGAIN)
-                {
-                    this->cmd_stderr = formatString("Error during read() from cmd STDERR: %s", strerror(errno));
-                    this->cmd_term_sig = SIGABRT;
-                    break;
-                }
-
-                // Stderr while running is likely progress output in our scripots.
-                flush_stderr(LogLevel::LOG_NOTICE, false);
+                stdin_fds.close_write_fd();
+                fds[0].fd = -1;
+                fds[0].events = 0;
             }
-
-            if (fds[0].revents & (POLLERR | POLLHUP))
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            logger->log(LOG_DEBUG5, "cmd STDOUT ready for read()");
+            ssize_t stdout_bytes_read = 0;
+            while ((stdout_bytes_read = read(stdout_fds->read_fd(), stdout_buf, CMDQD_PIPE_BUFFER_SIZE)) > 0)
             {
-                // The `poll()` man page says that, for STDIN, setting `fd = -1` won't make it be ignored.
-                // Luckily, we're in the parent process, and the STDIN of our child is not _our_ STDIN /
-                // FD 0.
-                fds[0].fd = -1;
+                stdout_bounds.append(cmd_stdout, stdout_buf, stdout_bytes_read);
             }
-            if (fds[1].revents & (POLLERR | POLLHUP))
+            if (stdout_bytes_read < 0 and errno != EAGAIN and errno != EINTR)
             {
-                fds[1].fd = -1;
+                this->cmd_stderr = formatString("Error during read() from cmd STDOUT: %s", strerror(errno));
+                this->cmd_term_sig = SIGABRT;
+                break;
+            }
+        }
+        if (fds[2].revents & POLLIN)
+        {
+            logger->log(LOG_DEBUG5, "cmd STDERR ready for read()");
+            ssize_t stderr_bytes_read = 0;
+            while ((stderr_bytes_read = read(stderr_fds->read_fd(), stderr_buf, CMDQD_PIPE_BUFFER_SIZE)) > 0)
+            {
+                stderr_bounds.append(cmd_stderr, stderr_buf, stderr_bytes_read);
             }
-            if (fds[2].revents & (POLLERR | POLLHUP))
+            if (stderr_bytes_read < 0 and errno != EAGAIN and errno != EINTR)
             {
-                fds[2].fd = -1;
+                this->cmd_stderr = formatString("Error during read() from cmd STDERR: %s", strerror(errno));
+                this->cmd_term_sig = SIGABRT;
+                break;
             }
-        } // if (fd_count > 0)
+
+            // Stderr while running is likely progress output in our scripots.
+            flush_stderr(LogLevel::LOG_NOTICE, false);
+        }
+
+        if (fds[0].revents & (POLLERR | POLLHUP))
+        {
+            // The `poll()` man page says that, for STDIN, setting `fd = -1` won't make it be ignored.
+            // Luckily, we're in the parent process, and the STDIN of our child is not _our_ STDIN /
+            // FD 0.
+            fds[0].fd = -1;
+        }
+        if (fds[1].revents & (POLLERR | POLLHUP))
+        {
+            fds[1].fd = -1;
+        }
+        if (fds[2].revents & (POLLERR | POLLHUP))
+        {
+            fds[2].fd = -1;
+        }
     } // while (true)
 
-    if (res_pid == 0)
-        res_pid = waitpid(pid, &wstatus, WNOHANG);
+    if (not exited)
+    {
+        // We only leave the loop before the child has exited when something went wrong on our side, in which
+        // case we don't want to leave the command behind.
+        kill(-pid, SIGKILL);
+    }
+
+    // The child has exited (or has been `SIGKILL`ed), so this `wait4()` won't block for long.
+    int wstatus;
+    struct rusage rusage;
+    pid_t res_pid;
+    while ((res_pid = wait4(pid, &wstatus, 0, &rusage)) < 0 and errno == EINTR) {}
 
     if (res_pid < 0)
     {
         this->cmd_term_sig = -1;  // -1 to make it obvious that this term sig doesn't come from POSIX.
         this->cmd_stderr += formatString(
-            "Unexpected error while calling `waitpid(%i, &wstatus, WNOHANG)`: '%s'",
+            "Unexpected error while calling `wait4(%i, &wstatus, 0, &rusage)`: '%s'",
             pid, strerror(errno)
         );
     }
-    else if (res_pid > 0)
+    else if (exited)
     {
+        this->cmd_rusage = rusage;
+
         if (not WIFEXITED(wstatus))
         {
-            if (WIFSIGNALED(wstatus))
+            if (WIFSIGNALED(wstatus) and limits.killed_by_cpu_limit(WTERMSIG(wstatus), rusage))
             {
-                this->cmd_term_sig = WTERMSIG(wstatus);
-                /*
-                this->cmd_stderr += formatString(
-                    "Process %i terminated with signal %i - %s",
-                    pid, this->cmd_term_sig.value(), strsignal(this->cmd_term_sig.value())
+                // Also when the command ignored the `SIGXCPU` and was `SIGKILL`ed at the hard limit.
+                this->cmd_term_sig = SIGXCPU;
+                logger->log(
+                    LOG_WARNING, "cmd_id = '%s'%s: exceeded the queue's RLIMIT_CPU of %ju seconds",
+                    meta.cmd_id.c_str(),
+                    meta.cmd_subid ? std::string(" (cmd_subid = '" + meta.cmd_subid.value() + "')").c_str() : "",
+                    (uintmax_t) limits.rlimit_cpu_sec.value()
                 );
-                */
+            }
+            else if (WIFSIGNALED(wstatus))
+            {
+                this->cmd_term_sig = WTERMSIG(wstatus);
             }
             else
             {
@@ -556,6 +972,123 @@ void NixQueueCmd::run_cmd(std::shared_ptr<PG::conn> &conn, const double queue_cm
         }
     }
 
+    if (stdout_memfd)
+    {
+        try
+        {
+            stdout_memfd->map();
+            stderr_memfd->map();
+        }
+        catch (const std::runtime_error &ex)
+        {
+            logger->log(LOG_ERROR, "Could not mmap() the output of PID %i: %s", pid, ex.what());
+            stdout_memfd.reset();
+            this->cmd_stderr += formatString("Could not mmap() the output of PID %i: %s\n", pid, ex.what());
+            return;
+        }
+
+        // The STDERR is copied anyway, because we log it line by line.
+        const std::string_view err = stderr_memfd->view();
+        stderr_bounds.append(cmd_stderr, err.data(), err.size());
+        flush_stderr(LogLevel::LOG_NOTICE, false);
+
+        // The STDOUT stays where it is, unless it has to be truncated.
+        const std::string_view out = stdout_memfd->view();
+        if (cmd_queue.queue_max_stdout_bytes and out.size() > cmd_queue.queue_max_stdout_bytes.value())
+        {
+            stdout_bounds.append(cmd_stdout, out.data(), out.size());
+            stdout_memfd.reset();
+        }
+    }
+}
+
+void NixQueueCmd::run_cmd(std::shared_ptr<PG::conn> &conn, const CmdQueue &cmd_queue, RunnerState &runner_state)
+{
+    logger->log(
+        LOG_INFO, "cmd_id = '%s'%s: \x1b[1m%s\x1b[22m",
+        meta.cmd_id.c_str(),
+        meta.cmd_subid ? std::string(" (cmd_subid = '" + meta.cmd_subid.value() + "')").c_str() : "",
+        cmd_line().c_str()
+    );
+
+    stdout_bounds = BoundedOutput(cmd_queue.queue_max_stdout_bytes);
+    stderr_bounds = BoundedOutput(cmd_queue.queue_max_stderr_bytes);
+
+    if (runs_in_worker(cmd_queue))
+        run_cmd_in_worker(cmd_queue, runner_state);
+    else
+        run_cmd_in_child(cmd_queue, runner_state);
+
+    stdout_bounds.finish(cmd_stdout);
+    stderr_bounds.finish(cmd_stderr);
+    cmd_stdout_bytes = stdout_memfd ? stdout_view().size() : stdout_bounds.total_bytes();
+    cmd_stderr_bytes = stderr_bounds.total_bytes();
+    if (stdout_bounds.truncated() or stderr_bounds.truncated())
+    {
+        logger->log(
+            LOG_WARNING, "cmd_id = '%s'%s: output truncated; %zu bytes of STDOUT and %zu bytes of STDERR were written",
+            meta.cmd_id.c_str(),
+            meta.cmd_subid ? std::string(" (cmd_subid = '" + meta.cmd_subid.value() + "')").c_str() : "",
+            cmd_stdout_bytes.value(),
+            cmd_stderr_bytes.value()
+        );
+    }
+
+    log_cmd_result();
+    spill_output(cmd_queue);
+    encode_output(cmd_queue);
+}
+
+void NixQueueCmd::spill_output(const CmdQueue &cmd_queue)
+{
+    if (not cmd_queue.queue_output_spill_dir)
+        return;
+
+    const BlobStore blob_store(cmd_queue.queue_output_spill_dir.value());
+
+    // If the output can't be spilled, it is kept in the queue, which is better than losing it.
+    try
+    {
+        if (stdout_view().size() > cmd_queue.queue_output_spill_threshold_bytes)
+        {
+            cmd_stdout_blob = blob_store.store(stdout_view());
+            cmd_stdout.clear();
+            stdout_memfd.reset();
+        }
+        if (cmd_stderr.size() > cmd_queue.queue_output_spill_threshold_bytes)
+        {
+            cmd_stderr_blob = blob_store.store(cmd_stderr);
+            cmd_stderr.clear();
+        }
+    }
+    catch (const std::runtime_error &ex)
+    {
+        logger->log(LOG_ERROR, "cmd_id = '%s': could not spill output to %s: %s",
+                    meta.cmd_id.c_str(), cmd_queue.queue_output_spill_dir.value().c_str(), ex.what());
+    }
+}
+
+void NixQueueCmd::encode_output(const CmdQueue &cmd_queue)
+{
+    if (not cmd_queue.queue_output_codec)
+        return;
+
+    if (cmd_queue.queue_output_codec.value() == "lz4")
+    {
+        cmd_stdout = lz4_frame_compress(stdout_view());
+        cmd_stderr = lz4_frame_compress(cmd_stderr);
+        stdout_memfd.reset();
+    }
+    else
+    {
+        // The `CHECK` constraint on `queue_output_codec` should make this impossible.
+        logger->log(LOG_ERROR, "Unsupported queue_output_codec: '%s'; output is left uncompressed.",
+                    cmd_queue.queue_output_codec.value().c_str());
+    }
+}
+
+void NixQueueCmd::log_cmd_result()
+{
     if (not cmd_succeeded())
     {
         if (cmd_exit_code.has_value() and cmd_exit_code.value() != 0)
@@ -571,11 +1104,13 @@ void NixQueueCmd::run_cmd(std::shared_ptr<PG::conn> &conn, const double queue_cm
         logger->log(LOG_ERROR, "==== BEGIN PROCESS STDERR ===");
 
         // Repeat the stderr as error when the command failed. There will be some duplicate logging, but by lack of a 'stdlog', it's unavoidable.
-        this->flush_stderr_pos = 0;
-        flush_stderr(LogLevel::LOG_ERROR, true);
+        stderr_lines.finish(cmd_stderr, [](std::string_view) {});
+        stderr_lines.replay(cmd_stderr, [this](std::string_view line) {
+            logger->log(LOG_ERROR, "%.*s", (int)line.size(), line.data());
+        });
 
         logger->log(LOG_ERROR, "==== END PROCESS STDERR ===");
     }
 
-    logger->logstream(LOG_DEBUG5) << "Command " << meta.cmd_id << " STDOUT: " << cmd_stdout;
+    logger->logstream(LOG_DEBUG5) << "Command " << meta.cmd_id << " STDOUT: " << stdout_view();
 }
@@ -4,11 +4,21 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include <sys/resource.h>
+
 #include "pq-raii/libpq-raii.hpp"
+#include "blobstore.h"
+#include "boundedoutput.h"
+#include "cmdqueue.h"
+#include "executablecache.h"
+#include "linesplitter.h"
+#include "memfdoutput.h"
 #include "logger.h"
+#include "nixqueueworker.h"
 #include "queuecmdmetadata.h"
 
 class NixQueueCmd
@@ -19,11 +29,32 @@ class NixQueueCmd
 
     bool cmd_succeeded() const;
 
-    int flush_stderr_pos = 0;
+    LineSplitter stderr_lines;
+
+    BoundedOutput stdout_bounds;
+    BoundedOutput stderr_bounds;
 
     void flush_stderr(LogLevel level, bool flush_on_end);
 
+    void log_cmd_result();
+
 public:
+    /**
+     * State that outlives a single command and is kept by the `CmdQueueRunner` between commands.
+     */
+    struct RunnerState
+    {
+        std::unique_ptr<NixQueueWorker> worker;
+
+        /**
+         * The environment that every command starts out with, as `NAME=value` strings, so that it needn't
+         * be looked up again for every command.
+         */
+        std::vector<std::string> base_env = NixQueueCmd::base_env();
+
+        ExecutableCache executables;
+    };
+
     QueueCmdMetadata meta;
 
     std::vector<std::string> cmd_argv;
@@ -34,10 +65,49 @@ public:
     std::string cmd_stdout = "";
     std::string cmd_stderr = "";
 
-    NixQueueCmd(
-            const PG::result &result,
-            int row,
-            const std::unordered_map<std::string, int> &fieldMapping) noexcept;
+    /**
+     * When the queue's `queue_output_capture` is `"memfd"`, the command's STDOUT stays in here, rather than
+     * being copied into `cmd_stdout`; use `stdout_view()` to get at it either way.
+     */
+    std::unique_ptr<MemfdOutput> stdout_memfd;
+
+    /**
+     * Only set for commands that we reaped ourselves, which excludes commands that are run in a worker.
+     */
+    std::optional<struct rusage> cmd_rusage;
+
+    /**
+     * How many bytes the command wrote to its STDOUT and STDERR, including what was left out of `cmd_stdout`
+     * and `cmd_stderr` due to the queue's `queue_max_stdout_bytes` and `queue_max_stderr_bytes`.
+     */
+    std::optional<size_t> cmd_stdout_bytes;
+    std::optional<size_t> cmd_stderr_bytes;
+
+    /**
+     * Where the output went instead of into `cmd_stdout` and `cmd_stderr`, if the queue has a
+     * `queue_output_spill_dir` and the output was bigger than its `queue_output_spill_threshold_bytes`.
+     */
+    std::optional<BlobStore::Ref> cmd_stdout_blob;
+    std::optional<BlobStore::Ref> cmd_stderr_blob;
+
+    /**
+     * The columns of a `nix_queue_cmd` `SELECT` result, following those of the `QueueCmdMetadata`.
+     */
+    enum Column
+    {
+        CMD_ARGV = QueueCmdMetadata::COLUMNS.size(),
+        CMD_ENV,
+        CMD_STDIN,
+    };
+    static constexpr PG::column_names<QueueCmdMetadata::COLUMNS.size() + 3> COLUMNS
+        = PG::concat_column_names(QueueCmdMetadata::COLUMNS, PG::column_names<3>{
+            "cmd_argv",
+            "cmd_env",
+            "cmd_stdin",
+        });
+    typedef PG::column_numbers<COLUMNS.size()> ColumnNumbers;
+
+    NixQueueCmd(const PG::row &row, const ColumnNumbers &columns) noexcept;
     NixQueueCmd(
             const std::string &cmd_class_identity,
             const std::string &cmd_class_relname,
@@ -51,13 +121,41 @@ public:
 
     std::string update_stmt(const std::shared_ptr<PG::conn> &conn);
 
-    std::vector<std::optional<std::string>> update_params() const;
-    std::vector<int> update_param_lengths() const;
-    std::vector<int> update_param_formats() const;
+    /**
+     * Bind the parameters of the prepared `update_cmd` statement, with `cmd_stdout` and `cmd_stderr` bound to
+     * wherever they are in memory, so that they needn't be copied; see `PG::params`.
+     */
+    void bind_update_params(PG::params &params) const;
 
     std::string cmd_line() const;
 
-    void run_cmd(std::shared_ptr<PG::conn> &conn, const double queue_cmd_timeout);
+    std::string_view stdout_view() const;
+
+    /**
+     * The part of `pg_cmdqd`'s own environment that is passed on to commands; that is: only the `PATH`.
+     */
+    static std::vector<std::string> base_env();
+
+    /**
+     * The `base_env` with the `cmd_env` on top of it, as `NAME=value` strings.
+     */
+    std::vector<std::string> env_strings(const std::vector<std::string> &base_env) const;
+
+    bool runs_in_worker(const CmdQueue &cmd_queue) const;
+    void run_cmd_in_worker(const CmdQueue &cmd_queue, RunnerState &runner_state);
+    void run_cmd_in_child(const CmdQueue &cmd_queue, RunnerState &runner_state);
+
+    /**
+     * Compress `cmd_stdout` and `cmd_stderr` with the `queue_output_codec`, if the queue has one.
+     */
+    void encode_output(const CmdQueue &cmd_queue);
+
+    /**
+     * Move `cmd_stdout` and/or `cmd_stderr` to the queue's `queue_output_spill_dir`, if they're too big.
+     */
+    void spill_output(const CmdQueue &cmd_queue);
+
+    void run_cmd(std::shared_ptr<PG::conn> &conn, const CmdQueue &cmd_queue, RunnerState &runner_state);
 };
 
 #endif // NIXQUEUECMD_H
@@ -0,0 +1,294 @@
+#include "nixqueueworker.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include "pipefds.h"
+#include "utils.h"
+
+extern char **environ;
+
+static void append_u32(std::string &buf, const uint32_t n)
+{
+    const uint32_t n_be = htonl(n);
+    buf.append(reinterpret_cast<const char *>(&n_be), sizeof(n_be));
+}
+
+static void append_str(std::string &buf, const std::string &s)
+{
+    append_u32(buf, s.size());
+    buf.append(s);
+}
+
+static uint32_t read_u32(std::string_view buf, std::string_view::size_type &pos)
+{
+    if (buf.size() - pos < sizeof(uint32_t))
+        throw std::runtime_error("Worker reply ends in the middle of a length or exit code.");
+    uint32_t n_be;
+    memcpy(&n_be, buf.data() + pos, sizeof(n_be));
+    pos += sizeof(n_be);
+    return ntohl(n_be);
+}
+
+static std::string_view read_str(std::string_view buf, std::string_view::size_type &pos)
+{
+    const uint32_t len = read_u32(buf, pos);
+    if (buf.size() - pos < len)
+        throw std::runtime_error("Worker reply ends in the middle of a string.");
+    std::string_view s = buf.substr(pos, len);
+    pos += len;
+    return s;
+}
+
+NixQueueWorker::NixQueueWorker(const std::vector<std::string> &argv, const std::vector<std::string> &env,
+                               const ProcessLimits &limits)
+    : argv(argv)
+{
+    if (argv.empty())
+        throw std::runtime_error("Cannot start a worker without an `argv`.");
+
+    PipeFds stdin_fds, stdout_fds;
+
+    std::vector<char *> c_argv = c_str_array(argv);
+    std::vector<char *> envp = c_str_array(env);
+
+    // See `NixQueueCmd::run_cmd()` for why we mask these signals until the child has its own process group.
+    sigset_t sig_mask, old_sig_mask;
+    sigemptyset(&sig_mask);
+    sigaddset(&sig_mask, SIGINT);
+    sigaddset(&sig_mask, SIGQUIT);
+    sigprocmask(SIG_SETMASK, &sig_mask, &old_sig_mask);
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        sigprocmask(SIG_SETMASK, &old_sig_mask, nullptr);
+        throw std::runtime_error(formatString("fork() failed: %s", strerror(errno)));
+    }
+
+    if (pid == 0)  // We're in the forked worker process.
+    {
+        stdin_fds.close_write_fd();
+        stdout_fds.close_read_fd();
+
+        while ((dup2(stdin_fds.read_fd(), STDIN_FILENO) == -1) && (errno == EINTR)) {}
+        while ((dup2(stdout_fds.write_fd(), STDOUT_FILENO) == -1) && (errno == EINTR)) {}
+
+        // The worker keeps `pg_cmdqd`'s STDERR, but nothing else.
+        struct rlimit rlim;
+        memset(&rlim, 0, sizeof (struct rlimit));
+        getrlimit(RLIMIT_NOFILE, &rlim);
+        for (rlim_t i = 3; i < rlim.rlim_cur; ++i) close (i);
+
+        if (setpgid(0, 0) < 0)
+        {
+            std::cerr << strerror(errno) << std::endl;
+            exit(128);
+        }
+
+        const char *failed_call = limits.apply();
+        if (failed_call)
+        {
+            const int limits_errno = errno;
+            std::cerr << failed_call << " error: " << strerror(limits_errno) << std::endl;
+            exit(128);
+        }
+
+        sigset_t empty_sigset;
+        sigemptyset(&empty_sigset);
+        sigprocmask(SIG_SETMASK, &empty_sigset, nullptr);
+
+        environ = envp.data();
+#ifdef _GNU_SOURCE
+        execvpe(c_argv[0], c_argv.data(), envp.data());
+#else
+        execvp(c_argv[0], c_argv.data());
+#endif
+
+        std::cerr << strerror(errno) << std::endl;
+        exit(127);
+    }
+
+    if (setpgid(pid, pid) < 0 and errno != EACCES)
+    {
+        sigprocmask(SIG_SETMASK, &old_sig_mask, nullptr);
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        throw std::runtime_error(formatString("setpgid() error: %s", strerror(errno)));
+    }
+    sigprocmask(SIG_SETMASK, &old_sig_mask, nullptr);
+
+    stdin_fds.close_read_fd();
+    stdout_fds.close_write_fd();
+
+    _stdin_fd = stdin_fds.release_write_fd();
+    _stdout_fd = stdout_fds.release_read_fd();
+    _pid = pid;
+
+    fcntl(_stdin_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(_stdout_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(_stdin_fd, F_SETFL, fcntl(_stdin_fd, F_GETFL) | O_NONBLOCK);
+    fcntl(_stdout_fd, F_SETFL, fcntl(_stdout_fd, F_GETFL) | O_NONBLOCK);
+
+    logger->log(LOG_INFO, "Started worker PID \x1b[1m%jd\x1b[22m", (intmax_t) _pid);
+}
+
+NixQueueWorker::~NixQueueWorker()
+{
+    if (_pid > 0)
+        retire(1);
+    close_fds();
+}
+
+void NixQueueWorker::close_fds()
+{
+    if (_stdin_fd >= 0)
+        while (close(_stdin_fd) == -1 && errno == EINTR) {}
+    if (_stdout_fd >= 0)
+        while (close(_stdout_fd) == -1 && errno == EINTR) {}
+    _stdin_fd = _stdout_fd = -1;
+}
+
+pid_t NixQueueWorker::pid() const
+{
+    return _pid;
+}
+
+int NixQueueWorker::stdin_fd() const
+{
+    return _stdin_fd;
+}
+
+int NixQueueWorker::stdout_fd() const
+{
+    return _stdout_fd;
+}
+
+int NixQueueWorker::cmds_run() const
+{
+    return _cmds_run;
+}
+
+void NixQueueWorker::count_cmd()
+{
+    _cmds_run++;
+}
+
+void NixQueueWorker::retire(const double grace_seconds)
+{
+    if (_pid <= 0)
+        return;
+
+    logger->log(LOG_INFO, "Retiring worker PID \x1b[1m%jd\x1b[22m after %i commands",
+                (intmax_t) _pid, _cmds_run);
+
+    close_fds();
+
+    const auto deadline = std::chrono::steady_clock::now()
+                          + std::chrono::microseconds((long)(grace_seconds * 1000000));
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        if (try_reap())
+            return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    logger->log(LOG_WARNING, "Worker PID %jd didn't exit on EOF; sending SIGKILL.", (intmax_t) _pid);
+    kill_and_reap(SIGKILL);
+}
+
+int NixQueueWorker::kill_and_reap(const int sig_num)
+{
+    int wstatus = 0;
+
+    if (_pid <= 0)
+        return wstatus;
+
+    kill(-_pid, sig_num);
+    while (waitpid(_pid, &wstatus, 0) < 0 && errno == EINTR) {}
+    _pid = -1;
+    close_fds();
+
+    return wstatus;
+}
+
+std::optional<int> NixQueueWorker::try_reap()
+{
+    int wstatus = 0;
+
+    if (_pid <= 0)
+        return {};
+
+    pid_t res_pid = waitpid(_pid, &wstatus, WNOHANG);
+    if (res_pid == 0)
+        return {};
+
+    _pid = -1;
+    close_fds();
+
+    if (res_pid < 0)
+        return -1;
+    return wstatus;
+}
+
+std::string NixQueueWorker::encode_request(
+        const std::vector<std::string> &argv_tail,
+        const std::unordered_map<std::string, std::string> &env,
+        const std::string &cmd_stdin)
+{
+    std::string payload;
+
+    append_u32(payload, argv_tail.size());
+    for (const std::string &arg : argv_tail)
+        append_str(payload, arg);
+
+    append_u32(payload, env.size());
+    for (const std::pair<const std::string, std::string> &var : env)
+    {
+        append_str(payload, var.first);
+        append_str(payload, var.second);
+    }
+
+    append_str(payload, cmd_stdin);
+
+    std::string frame;
+    frame.reserve(sizeof(uint32_t) + payload.size());
+    append_str(frame, payload);
+    return frame;
+}
+
+void NixQueueWorker::decode_reply(
+        std::string_view payload,
+        int &exit_code,
+        std::string_view &cmd_stdout,
+        std::string_view &cmd_stderr)
+{
+    std::string_view::size_type pos = 0;
+
+    exit_code = static_cast<int32_t>(read_u32(payload, pos));
+    cmd_stdout = read_str(payload, pos);
+    cmd_stderr = read_str(payload, pos);
+
+    if (pos != payload.size())
+        throw std::runtime_error("Trailing bytes after worker reply.");
+}
+
+std::optional<uint32_t> NixQueueWorker::frame_length(std::string_view buf)
+{
+    if (buf.size() < sizeof(uint32_t))
+        return {};
+
+    std::string_view::size_type pos = 0;
+    return read_u32(buf, pos);
+}
@@ -0,0 +1,101 @@
+#ifndef NIXQUEUEWORKER_H
+#define NIXQUEUEWORKER_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "logger.h"
+#include "processlimits.h"
+
+/**
+ * A long-lived process, started from a queue's `queue_worker_argv`, to which `nix_queue_cmd`s are handed
+ * one by one, instead of `fork()`/`exec()`ing each command separately.
+ *
+ * See the `cmd_queue.queue_worker_argv` column comment for a description of the framing protocol.
+ */
+class NixQueueWorker
+{
+    Logger *logger = Logger::getInstance();
+
+    pid_t _pid = -1;
+    int _stdin_fd = -1;
+    int _stdout_fd = -1;
+    int _cmds_run = 0;
+
+    void close_fds();
+
+public:
+    const std::vector<std::string> argv;
+
+    NixQueueWorker() = delete;
+    NixQueueWorker(const NixQueueWorker &other) = delete;
+    NixQueueWorker &operator=(const NixQueueWorker &other) = delete;
+
+    /**
+     * Start the worker process, with `env` (as `NAME=value` strings) as its environment and with the given
+     * `limits`.  Throws a `std::runtime_error` if that fails.
+     */
+    NixQueueWorker(const std::vector<std::string> &argv, const std::vector<std::string> &env,
+                   const ProcessLimits &limits = ProcessLimits());
+    ~NixQueueWorker();
+
+    pid_t pid() const;
+    int stdin_fd() const;
+    int stdout_fd() const;
+    int cmds_run() const;
+    void count_cmd();
+
+    /**
+     * Close the worker its STDIN and give it `grace_seconds` to exit before it is `SIGKILL`ed.
+     */
+    void retire(const double grace_seconds);
+
+    /**
+     * Send `sig_num` to the worker's process group and reap it.  Returns the `wait()` status.
+     */
+    int kill_and_reap(const int sig_num);
+
+    /**
+     * Reap the worker if it has already exited.  Returns the `wait()` status if it has.
+     */
+    std::optional<int> try_reap();
+
+    static std::string encode_request(
+            const std::vector<std::string> &argv_tail,
+            const std::unordered_map<std::string, std::string> &env,
+            const std::string &cmd_stdin);
+
+    /**
+     * The bytes in a reply payload besides the command's STDOUT and STDERR: the exit code and two lengths.
+     */
+    static constexpr size_t REPLY_OVERHEAD_BYTES = 3 * sizeof(uint32_t);
+
+    /**
+     * The most of a command's STDOUT or STDERR that a reply may carry when the queue sets no limit for it; it's
+     * also the most that a `bytea` can hold.
+     */
+    static constexpr size_t MAX_REPLY_STREAM_BYTES = 1 << 30;
+
+    /**
+     * Parse the payload of a reply frame (without its length prefix).  Throws a `std::runtime_error` on
+     * malformed input.  `cmd_stdout` and `cmd_stderr` point into `payload`, which must thus outlive them.
+     */
+    static void decode_reply(
+            std::string_view payload,
+            int &exit_code,
+            std::string_view &cmd_stdout,
+            std::string_view &cmd_stderr);
+
+    /**
+     * Returns the length of the payload that follows, if `buf` holds at least a complete length prefix.
+     */
+    static std::optional<uint32_t> frame_length(std::string_view buf);
+};
+
+#endif // NIXQUEUEWORKER_H
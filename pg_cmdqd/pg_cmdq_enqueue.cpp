@@ -0,0 +1,243 @@
+#include <ctype.h>
+
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cmdproducer.h"
+
+class CmdLineParseError : std::exception
+{
+    std::string _message;
+
+public:
+    CmdLineParseError(const std::string &msg)
+        : _message(msg) {}
+
+    const char *what() const noexcept override
+    {
+        return _message.data();
+    }
+};
+
+void usage(const char* program_name, std::ostream &stream = std::cout)
+{
+    stream << R"(Bulk-enqueue the commands read from STDIN into a command queue, by COPYing
+them in batches, with one NOTIFY to the pg_cmdqd per batch.
+
+Usage:
+    )" << program_name << R"( [ options ] <cmd_class> [ <connection_string> ]
+    )" << program_name << R"( --help
+
+Options:
+    --batch-size <count>
+
+STDIN has one command per line, in the text format of COPY (tab-separated,
+with \N for NULL), with the fields:
+
+    for nix_queue_cmd_template-derived queues:
+        cmd_id, cmd_subid, cmd_argv [, cmd_env [, cmd_stdin ] ]
+    for sql_queue_cmd_template-derived queues:
+        cmd_id, cmd_subid, cmd_sql [, cmd_sql_params ]
+
+which is what \copy (SELECT cmd_id, cmd_subid, …) TO STDOUT gives you in psql.
+)";
+}
+
+/**
+ * Split a line of `COPY` text format into its fields, undoing the backslash escapes; `\N` becomes `std::nullopt`.
+ */
+std::vector<std::optional<std::string>> split_copy_text_line(std::string_view line)
+{
+    std::vector<std::optional<std::string>> fields;
+    std::string field;
+    bool field_is_null = false;
+
+    for (size_t i = 0; i <= line.size(); i++)
+    {
+        if (i == line.size() or line[i] == '\t')
+        {
+            if (field_is_null)
+                fields.push_back(std::nullopt);
+            else
+                fields.push_back(std::move(field));
+            field.clear();
+            field_is_null = false;
+            continue;
+        }
+
+        if (line[i] != '\\' or i + 1 == line.size())
+        {
+            field.push_back(line[i]);
+            continue;
+        }
+
+        const char c = line[++i];
+        switch (c)
+        {
+            case 'N': field_is_null = true; break;
+            case 'b': field.push_back('\b'); break;
+            case 'f': field.push_back('\f'); break;
+            case 'n': field.push_back('\n'); break;
+            case 'r': field.push_back('\r'); break;
+            case 't': field.push_back('\t'); break;
+            case 'v': field.push_back('\v'); break;
+            case 'x':
+            {
+                int value = 0;
+                size_t digits = 0;
+                for (; digits < 2 and i + 1 < line.size() and isxdigit(line[i + 1]); digits++)
+                {
+                    const char d = line[++i];
+                    value = value * 16 + (isdigit(d) ? d - '0' : (tolower(d) - 'a' + 10));
+                }
+                field.push_back(digits > 0 ? char(value) : 'x');
+                break;
+            }
+            default:
+                if (c >= '0' and c <= '7')
+                {
+                    int value = c - '0';
+                    for (size_t digits = 1; digits < 3 and i + 1 < line.size() and line[i + 1] >= '0' and line[i + 1] <= '7'; digits++)
+                        value = value * 8 + (line[++i] - '0');
+                    field.push_back(char(value));
+                }
+                else
+                    field.push_back(c);
+        }
+    }
+
+    return fields;
+}
+
+int main(const int argc, const char *argv[])
+{
+    std::string cmd_class;
+    std::string conn_str;
+    int positional_args = 0;
+    size_t batch_size = 10000;
+
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg(argv[i]);
+
+            if (arg == "--help")
+            {
+                usage(argv[0]);
+                exit(0);
+            }
+            else if (arg == "--batch-size")
+            {
+                if (++i == argc)
+                    throw CmdLineParseError("Missing value for \x1b[1m--batch-size\x1b[22m.");
+                try
+                {
+                    const long long n = std::stoll(argv[i]);
+                    if (n < 1)
+                        throw std::out_of_range(argv[i]);
+                    batch_size = n;
+                }
+                catch (const std::logic_error &)
+                {
+                    throw CmdLineParseError("\x1b[1m--batch-size\x1b[22m must be a positive number.");
+                }
+            }
+            else if (arg.substr(0, 2) != "--")
+            {
+                if (++positional_args == 1)
+                    cmd_class = arg;
+                else if (positional_args == 2)
+                    conn_str = arg;
+                else
+                    throw CmdLineParseError("Unexpected argument \x1b[1m" + arg + "\x1b[22m.");
+            }
+            else
+            {
+                throw CmdLineParseError("Unrecognized option \x1b[1m" + arg + "\x1b[22m.");
+            }
+        }
+
+        if (positional_args < 1)
+            throw CmdLineParseError("Missing \x1b[1m<cmd_class>\x1b[22m.");
+    }
+    catch (const CmdLineParseError &err)
+    {
+        std::cerr << "\x1b[31m" << err.what() << "\x1b[0m" << std::endl;
+        usage(argv[0], std::cerr);
+        exit(2);
+    }
+
+    std::ios::sync_with_stdio(false);
+
+    size_t line_number = 0;
+    std::optional<CmdProducer> producer;
+    try
+    {
+        std::shared_ptr<PG::conn> conn = PQ::connectdb(conn_str);
+        if (PQ::status(conn) != CONNECTION_OK)
+            throw std::runtime_error("Connection failed: " + PQ::errorMessage(conn));
+
+        producer.emplace(conn, cmd_class, batch_size);
+        const size_t min_fields = 3;
+        const size_t max_fields = producer->kind() == CmdProducer::Kind::NIX ? 5 : 4;
+
+        std::string line;
+        while (std::getline(std::cin, line))
+        {
+            line_number++;
+            if (line == "\\.")
+                break;
+
+            std::vector<std::optional<std::string>> fields = split_copy_text_line(line);
+            if (fields.size() < min_fields or fields.size() > max_fields)
+                throw std::invalid_argument("Expected " + std::to_string(min_fields) + " to "
+                                            + std::to_string(max_fields) + " fields; got "
+                                            + std::to_string(fields.size()) + ".");
+            fields.resize(max_fields);
+            if (not fields[0])
+                throw std::invalid_argument("The cmd_id cannot be NULL.");
+            if (not fields[2])
+                throw std::invalid_argument(producer->kind() == CmdProducer::Kind::NIX
+                                            ? "The cmd_argv cannot be NULL." : "The cmd_sql cannot be NULL.");
+
+            if (producer->kind() == CmdProducer::Kind::NIX)
+            {
+                producer->enqueue_nix_cmd(
+                    fields[0].value(),
+                    fields[1],
+                    PQ::from_text_array(fields[2].value()),
+                    fields[3] ? PQ::from_text_hstore(fields[3].value())
+                              : std::unordered_map<std::string, std::optional<std::string>>(),
+                    fields[4] ? PQ::from_text_bytea(fields[4].value()) : std::string());
+            }
+            else
+            {
+                std::optional<std::vector<std::optional<std::string>>> cmd_sql_params;
+                if (fields[3])
+                    cmd_sql_params = PQ::from_text_array_with_nulls(fields[3].value());
+                producer->enqueue_sql_cmd(fields[0].value(), fields[1], fields[2].value(), cmd_sql_params);
+            }
+        }
+
+        producer->flush();
+        std::cout << "Enqueued " << producer->cmds_enqueued() << " commands into " << cmd_class << "." << std::endl;
+    }
+    catch (const std::exception &err)
+    {
+        if (dynamic_cast<const std::invalid_argument *>(&err))
+            std::cerr << "\x1b[31mLine " << line_number << ": " << err.what() << "\x1b[0m" << std::endl;
+        else
+            std::cerr << "\x1b[31m" << err.what() << "\x1b[0m" << std::endl;
+
+        // The batches before the failed one have been committed already.
+        if (producer)
+            std::cerr << producer->cmds_enqueued() << " commands were enqueued before the error." << std::endl;
+        exit(1);
+    }
+
+    return 0;
+}
@@ -109,8 +109,10 @@ int main(const int argc, const char *argv[])
     NixQueueCmd nix_queue_cmd(cmd_class, cmd_class, cmd_id, cmd_subid, cmd_argv, {}, cmd_stdin);
 
     std::shared_ptr<PG::conn> null_conn(nullptr);
+    CmdQueue cmd_queue;
+    NixQueueCmd::RunnerState runner_state;
     nix_queue_cmd.meta.stamp_start_time();
-    nix_queue_cmd.run_cmd(null_conn, 0);
+    nix_queue_cmd.run_cmd(null_conn, cmd_queue, runner_state);
     nix_queue_cmd.meta.stamp_end_time();
 
     std::shared_ptr<PG::conn> conn = PQ::connectdb("");
@@ -60,3 +60,17 @@ void PipeFds::close_write_fd()
     this->fds[1] = -1;
     if (close_result == -1) throw std::runtime_error(strerror(errno));
 }
+
+int PipeFds::release_read_fd()
+{
+    int fd = this->fds[0];
+    this->fds[0] = -1;
+    return fd;
+}
+
+int PipeFds::release_write_fd()
+{
+    int fd = this->fds[1];
+    this->fds[1] = -1;
+    return fd;
+}
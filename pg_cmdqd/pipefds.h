@@ -13,6 +13,16 @@ public:
     int write_fd() const;
     void close_read_fd();
     void close_write_fd();
+
+    /**
+     * Give up ownership of the read end of the pipe; the caller becomes responsible for `close()`ing it.
+     */
+    int release_read_fd();
+
+    /**
+     * Give up ownership of the write end of the pipe; the caller becomes responsible for `close()`ing it.
+     */
+    int release_write_fd();
 };
 
 #endif // PIPEFDS_H
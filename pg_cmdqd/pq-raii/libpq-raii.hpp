@@ -2,18 +2,33 @@
 #define LIBPQ_RAII_HPP
 
 #include "postgres_ext.h"
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <charconv>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <optional>
 #include <map>
 #include <memory>
 #include <unordered_map>
-#include <regex>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <strings.h>
 #include <vector>
 
 #include <libpq-fe.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /**
  * This library, rather than pouring the OO flavor of the day on top of libpq, really does little more than
  * wrapping the `PG…` pointer types in RAII wrappers.  The existing libpq function and type names are
@@ -91,6 +106,8 @@ namespace PG
 
         result &operator=(result &&other)
         {
+            if (this->res and this->res != other.res)
+                PQclear(this->res);
             res = other.res;
             other.res = nullptr;
 
@@ -123,6 +140,210 @@ namespace PG
         */
     };
 
+    /**
+     * A row in a `PG::result`, of which the values can be looked at as `std::string_view`s instead of as copies.
+     *
+     * The row shares ownership of the result, so that the views that it hands out stay valid for as long as the
+     * row (or a copy of it) is around, even when whoever got the result in the first place has moved on.
+     */
+    class row
+    {
+        std::shared_ptr<const result> _result;
+        int _row_number;
+
+    public:
+        row(std::shared_ptr<const result> res, int row_number)
+            : _result(std::move(res)), _row_number(row_number)
+        {}
+
+        const result &get_result() const
+        {
+            return *_result;
+        }
+
+        int row_number() const
+        {
+            return _row_number;
+        }
+
+        bool isnull(int column_number) const
+        {
+            return PQgetisnull(_result->get(), _row_number, column_number) == 1;
+        }
+
+        /**
+         * Whether the column is in binary (`1`) or in text (`0`) format.
+         */
+        int format(int column_number) const
+        {
+            return PQfformat(_result->get(), column_number);
+        }
+
+        /**
+         * The value, which, unlike what the `std::string_view` promises, is always followed by a `NUL` byte.
+         * (A `NULL` value is an empty string.)
+         */
+        std::string_view value(int column_number) const
+        {
+            return std::string_view(PQgetvalue(_result->get(), _row_number, column_number),
+                                    PQgetlength(_result->get(), _row_number, column_number));
+        }
+
+        std::optional<std::string_view> nullable(int column_number) const
+        {
+            if (isnull(column_number))
+                return std::nullopt;
+            return value(column_number);
+        }
+    };
+
+    /**
+     * The parameters for executing a statement, as the value, length and format arrays that libpq wants.
+     *
+     * `bind_text()` and `bind_binary()` only remember where a value is in memory, so that a big value (like the
+     * `cmd_stdout` of a command) reaches libpq without being copied; the value must thus stay put until the
+     * statement has been executed.  Values that don't exist as such yet are formatted into buffers of the
+     * `params` itself.  `clear()` forgets the values but keeps the memory, so that a `params` that is reused for
+     * every execution stops allocating once it has seen the biggest set of parameters.
+     */
+    class params
+    {
+        std::vector<const char *> _values;
+        std::vector<int> _lengths;
+        std::vector<int> _formats;
+        std::deque<std::string> _buffers;  // A `std::deque`, so that adding a buffer doesn't move the others.
+        size_t _buffers_used = 0;
+
+        void bind(const char *value, int length, int format)
+        {
+            _values.push_back(value);
+            _lengths.push_back(length);
+            _formats.push_back(format);
+        }
+
+        std::string &next_buffer()
+        {
+            if (_buffers_used == _buffers.size())
+                _buffers.emplace_back();
+            return _buffers[_buffers_used++];
+        }
+
+    public:
+        void clear()
+        {
+            _values.clear();
+            _lengths.clear();
+            _formats.clear();
+            _buffers_used = 0;
+        }
+
+        void bind_null()
+        {
+            bind(nullptr, 0, 0);
+        }
+
+        /**
+         * Bind a `NUL`-terminated value in text format.
+         */
+        void bind_text(const char *text)
+        {
+            bind(text, 0, 0);
+        }
+
+        void bind_text(const std::string &text)
+        {
+            bind_text(text.c_str());
+        }
+
+        void bind_text(const std::optional<std::string> &text)
+        {
+            if (text)
+                bind_text(text.value());
+            else
+                bind_null();
+        }
+
+        // A temporary would be gone before the statement is executed; use `bind_copy()` for those.
+        void bind_text(std::string &&text) = delete;
+        void bind_text(std::optional<std::string> &&text) = delete;
+
+        void bind_binary(const char *data, size_t length)
+        {
+            bind(data, static_cast<int>(length), 1);
+        }
+
+        void bind_binary(std::string_view data)
+        {
+            bind_binary(data.data(), data.size());
+        }
+
+        /**
+         * Bind a copy of a value in text format, for values that won't outlive the call.
+         */
+        void bind_copy(std::string_view text)
+        {
+            std::string &buffer = next_buffer();
+            buffer.assign(text);
+            bind_text(buffer);
+        }
+
+        void bind_integer(const std::optional<long long> &n)
+        {
+            if (not n)
+                return bind_null();
+
+            char digits[24];
+            const std::to_chars_result end = std::to_chars(digits, digits + sizeof(digits), n.value());
+            bind_copy(std::string_view(digits, end.ptr - digits));
+        }
+
+        /**
+         * Bind a value in text format that is formatted with `vsnprintf()`, straight into a buffer of our own.
+         */
+        __attribute__((format(printf, 2, 3)))
+        void bind_printf(const char *format, ...)
+        {
+            std::string &buffer = next_buffer();
+            buffer.resize(buffer.capacity());
+
+            va_list args;
+            for (int attempt = 0; attempt < 2; attempt++)
+            {
+                va_start(args, format);
+                const int n = vsnprintf(buffer.data(), buffer.size() + 1, format, args);
+                va_end(args);
+                if (n < 0)
+                    throw std::runtime_error("vsnprintf() failed");
+                const bool fits = static_cast<size_t>(n) <= buffer.size();
+                buffer.resize(n);
+                if (fits)
+                    break;
+            }
+
+            bind_text(buffer);
+        }
+
+        int size() const
+        {
+            return static_cast<int>(_values.size());
+        }
+
+        const char *const *values() const
+        {
+            return _values.data();
+        }
+
+        const int *lengths() const
+        {
+            return _lengths.data();
+        }
+
+        const int *formats() const
+        {
+            return _formats.data();
+        }
+    };
+
     class notify
     {
         PGnotify *d = nullptr;
@@ -164,6 +385,78 @@ namespace PG
         }
     };
 
+    /**
+     * The names of the columns that a type expects in a result, in the order of the type's own column indexes.
+     */
+    template<size_t N>
+    using column_names = std::array<const char *, N>;
+
+    /**
+     * The `column_names` of `a`, followed by those of `b`, for types that are made up of other types.
+     */
+    template<size_t N, size_t M>
+    constexpr column_names<N + M>
+    concat_column_names(const column_names<N> &a, const column_names<M> &b)
+    {
+        column_names<N + M> names{};
+        for (size_t i = 0; i < N; i++)
+            names[i] = a[i];
+        for (size_t i = 0; i < M; i++)
+            names[N + i] = b[i];
+        return names;
+    }
+
+    /**
+     * The field numbers, in a specific result (or in the description of a prepared statement, which has the
+     * same fields as the results of that statement), of a type's `column_names`.
+     *
+     * The names are looked up once, after which getting at a column of a row is a matter of indexing into a
+     * small array, rather than of hashing the column name for every row.
+     */
+    template<size_t N>
+    class column_numbers
+    {
+        template<size_t> friend class column_numbers;
+
+        std::array<int, N> _numbers;
+
+    public:
+        column_numbers()
+        {
+            _numbers.fill(-1);
+        }
+
+        /**
+         * Throws if any of the `names` is not in the result.
+         */
+        column_numbers(const result &res, const column_names<N> &names)
+        {
+            for (size_t i = 0; i < N; i++)
+            {
+                _numbers[i] = PQfnumber(res.get(), names[i]);
+                if (_numbers[i] < 0)
+                    throw std::invalid_argument(std::string("Missing column in result: ") + names[i]);
+            }
+        }
+
+        int operator[](size_t column) const
+        {
+            return _numbers[column];
+        }
+
+        /**
+         * The field numbers of the first `M` columns, for the type of which the columns come first.
+         */
+        template<size_t M>
+        column_numbers<M> head() const
+        {
+            static_assert(M <= N);
+            column_numbers<M> head_numbers;
+            std::copy(_numbers.begin(), _numbers.begin() + M, head_numbers._numbers.begin());
+            return head_numbers;
+        }
+    };
+
     /**
      * \brief The tuple_iterator knows how to iterate over rows and use operatior*() to construct an object
      * of the templated type.
@@ -172,6 +465,9 @@ namespace PG
      * doesn't return a reference, because that's impossible, though the objected created is a local copy,
      * which can be moved.
      *
+     * The type declares its columns as a `static constexpr` `PG::column_names` called `COLUMNS`, and has a
+     * constructor that takes a `PG::row` and the `PG::column_numbers` of those columns.
+     *
      * The snake case name of this class is intentionally a bit more towards the STL conventions than the
      * libpq conventions, though libpq mixes styles _a lot_.
      */
@@ -180,7 +476,7 @@ namespace PG
     {
         std::shared_ptr<PG::result> result;
         std::shared_ptr<PG::conn> conn;
-        std::unordered_map<std::string, int> fieldMappings;
+        column_numbers<T::COLUMNS.size()> columns;
         int row = 0;
         int rowCount = 0;
         int fieldCount = 0;
@@ -202,15 +498,10 @@ namespace PG
                 int fieldCount) :
             result(result),
             conn(conn),
+            columns(*result, T::COLUMNS),
             rowCount(rowCount),
             fieldCount(fieldCount)
         {
-            fieldMappings.reserve(fieldCount);
-            for (int i = 0; i < fieldCount; i++)
-            {
-                std::string value = PQfname(result->get(), i);
-                fieldMappings[value] = i;
-            }
         }
 
         bool operator!=(tuple_iterator &rhs)
@@ -232,9 +523,9 @@ namespace PG
         T operator*()
         {
             if (row >= rowCount)
-                std::runtime_error("Trying to dereference invalid iterator");
+                throw std::runtime_error("Trying to dereference invalid iterator");
 
-            T t(result, row, fieldMappings);
+            T t(PG::row(result, row), columns);
             return t;
         }
     };
@@ -348,6 +639,90 @@ namespace PQ
         return PG::result(PQexec(conn->get(), command.c_str()));
     }
 
+    inline bool
+    sendQuery(const std::shared_ptr<PG::conn> &conn, const std::string &command)
+    {
+        return (bool)PQsendQuery(conn->get(), command.c_str());
+    }
+
+    inline bool
+    setSingleRowMode(const std::shared_ptr<PG::conn> &conn)
+    {
+        return (bool)PQsetSingleRowMode(conn->get());
+    }
+
+    inline bool
+    sendQueryParams(
+            const std::shared_ptr<PG::conn> &conn,
+            const std::string &command,
+            const std::vector<const char *> &paramValues)
+    {
+        return (bool)PQsendQueryParams(
+                conn->get(), command.c_str(), paramValues.size(), nullptr, paramValues.data(), nullptr, nullptr, 0);
+    }
+
+    inline bool
+    sendQueryPrepared(
+            const std::shared_ptr<PG::conn> &conn,
+            const std::string &stmtName,
+            const std::vector<const char *> &paramValues)
+    {
+        return (bool)PQsendQueryPrepared(
+                conn->get(), stmtName.c_str(), paramValues.size(), paramValues.data(), nullptr, nullptr, 0);
+    }
+
+    inline bool
+    sendQueryParams(
+            const std::shared_ptr<PG::conn> &conn,
+            const std::string &command,
+            const PG::params &params)
+    {
+        return (bool)PQsendQueryParams(
+                conn->get(), command.c_str(), params.size(), nullptr, params.values(), params.lengths(),
+                params.formats(), 0);
+    }
+
+    inline bool
+    sendQueryPrepared(
+            const std::shared_ptr<PG::conn> &conn,
+            const std::string &stmtName,
+            const PG::params &params)
+    {
+        return (bool)PQsendQueryPrepared(
+                conn->get(), stmtName.c_str(), params.size(), params.values(), params.lengths(), params.formats(),
+                0);
+    }
+
+#ifdef LIBPQ_HAS_CHUNK_MODE
+    inline bool
+    setChunkedRowsMode(const std::shared_ptr<PG::conn> &conn, int chunkSize)
+    {
+        return (bool)PQsetChunkedRowsMode(conn->get(), chunkSize);
+    }
+#endif
+
+    /**
+     * Returns a `PG::result` wrapping a `nullptr` once all the results of the command have been returned.
+     */
+    inline PG::result
+    getResult(const std::shared_ptr<PG::conn> &conn)
+    {
+        return PG::result(PQgetResult(conn->get()));
+    }
+
+    /**
+     * The `paramValues` array for `PQexecParams()` and `PQexecPrepared()`, with `nullptr` for `NULL`s.
+     */
+    inline std::vector<const char *>
+    param_values(const std::vector<std::optional<std::string>> &paramValues)
+    {
+        std::vector<const char *> rawValues;
+        rawValues.reserve(paramValues.size());
+        for (const std::optional<std::string> &paramValue : paramValues)
+            rawValues.push_back(paramValue ? paramValue.value().c_str() : nullptr);
+        return rawValues;
+    }
+
     inline PG::result
     execParams(
             const std::shared_ptr<PG::conn> &conn,
@@ -359,10 +734,7 @@ namespace PQ
             const std::optional<std::vector<int>> &paramFormats = {},
             int resultFormat = 0)
     {
-        std::vector<char *> rawValues; rawValues.reserve(paramValues.size());
-        rawValues.clear();
-        for (const std::optional<std::string> &paramValue : paramValues)
-            rawValues.push_back(paramValue ? const_cast<char*>(paramValue.value().c_str()) : nullptr);
+        const std::vector<const char *> rawValues = param_values(paramValues);
 
         return PG::result(PQexecParams(
                 conn->get(),
@@ -391,32 +763,63 @@ namespace PQ
                 paramTypes ? paramTypes.value().data() : nullptr));
     }
 
+    /**
+     * `PQexecPrepared()`, with the parameter values as raw pointers, which need not point into
+     * `std::string`s; binary parameters can thus be passed on from wherever they already are in memory.
+     */
     inline PG::result
     execPrepared(
             const std::shared_ptr<PG::conn> &conn,
             const std::string &stmtName,
-            int nParams = 0,
-            const std::vector<std::optional<std::string>> &paramValues = {},
+            int nParams,
+            const std::vector<const char *> &paramValues,
             const std::optional<std::vector<int>> &paramLengths = {},
             const std::optional<std::vector<int>> &paramFormats = {},
             int resultFormat = 0)
     {
-        std::vector<char *> rawValues; rawValues.reserve(paramValues.size());
-        rawValues.clear();
-        for (const std::optional<std::string> &paramValue : paramValues)
-            rawValues.push_back(paramValue ? const_cast<char*>(paramValue.value().c_str()) : nullptr);
-
         return PG::result(PQexecPrepared(
                 conn->get(),
                 stmtName.c_str(),
                 nParams,
-                rawValues.data(),
+                paramValues.data(),
                 paramLengths ? paramLengths.value().data() : nullptr,
                 paramFormats ? paramFormats.value().data() : nullptr,
                 resultFormat
                 ));
     }
 
+    /**
+     * Like the `execPrepared()` above, but with the parameter values as `std::string`s.
+     */
+    inline PG::result
+    execPrepared(
+            const std::shared_ptr<PG::conn> &conn,
+            const std::string &stmtName,
+            int nParams = 0,
+            const std::vector<std::optional<std::string>> &paramValues = {},
+            const std::optional<std::vector<int>> &paramLengths = {},
+            const std::optional<std::vector<int>> &paramFormats = {},
+            int resultFormat = 0)
+    {
+        return execPrepared(
+                conn, stmtName, nParams, param_values(paramValues), paramLengths, paramFormats, resultFormat);
+    }
+
+    /**
+     * `PQexecPrepared()` with parameters bound to a `PG::params`.
+     */
+    inline PG::result
+    execPrepared(
+            const std::shared_ptr<PG::conn> &conn,
+            const std::string &stmtName,
+            const PG::params &params,
+            int resultFormat = 0)
+    {
+        return PG::result(PQexecPrepared(
+                conn->get(), stmtName.c_str(), params.size(), params.values(), params.lengths(), params.formats(),
+                resultFormat));
+    }
+
     inline PG::result
     describePrepared(
             const std::shared_ptr<PG::conn> &conn,
@@ -552,10 +955,25 @@ namespace PQ
         */
     }
 
+    /**
+     * The value as is, in whichever format the result has it.  (Binary values can contain `NUL` bytes, so we go by
+     * `PQgetlength()`, not by the terminating `NUL` that libpq adds.)
+     */
     inline std::string
     getvalue(const PG::result &res, int row_number, int column_number)
     {
-        return std::string(PQgetvalue(res.get(), row_number, column_number));
+        return std::string(PQgetvalue(res.get(), row_number, column_number),
+                           PQgetlength(res.get(), row_number, column_number));
+    }
+
+    /**
+     * Like `getvalue()`, but without copying the value out of the result, which must thus outlive the view.
+     */
+    inline std::string_view
+    getvalue_view(const PG::result &res, int row_number, int column_number)
+    {
+        return std::string_view(PQgetvalue(res.get(), row_number, column_number),
+                                PQgetlength(res.get(), row_number, column_number));
     }
 
     inline std::string
@@ -576,7 +994,18 @@ namespace PQ
     {
         if (PQgetisnull(res.get(), row_number, column_number) == 1)
             return {};
-        return std::string(PQgetvalue(res.get(), row_number, column_number));
+        return getvalue(res, row_number, column_number);
+    }
+
+    /**
+     * Like `getnullable()`, but without copying the value out of the result, which must thus outlive the view.
+     */
+    inline std::optional<std::string_view>
+    getnullable_view(const PG::result &res, int row_number, int column_number)
+    {
+        if (PQgetisnull(res.get(), row_number, column_number) == 1)
+            return std::nullopt;
+        return getvalue_view(res, row_number, column_number);
     }
 
     inline std::optional<std::string>
@@ -615,12 +1044,12 @@ namespace PQ
 
     inline std::string
     escapeByteaConn(const std::shared_ptr<PG::conn> &conn,
-                    const std::string &from)
+                    std::string_view from)
     {
         size_t to_size;
         unsigned char *raw_to = PQescapeByteaConn(
                 conn->get(),
-                (const unsigned char *)from.c_str(),
+                (const unsigned char *)from.data(),
                 (size_t)from.size(),
                 &to_size);
         std::string to((const char *)raw_to);
@@ -628,21 +1057,22 @@ namespace PQ
         return to;
     }
 
-    inline std::string
-    double_quote(const std::string &unquoted)
+    inline std::optional<std::string>
+    as_text(const std::optional<int> &i)
     {
-        static std::regex re("\"|\\\\");
+        if (not i.has_value())
+            return {};
 
-        return std::string("\"") + std::regex_replace(unquoted, re, "\\$&") + "\"";
+        return std::to_string(i.value());
     }
 
     inline std::optional<std::string>
-    as_text(const std::optional<int> &i)
+    as_text(const std::optional<size_t> &n)
     {
-        if (not i.has_value())
+        if (not n.has_value())
             return {};
 
-        return std::to_string(i.value());
+        return std::to_string(n.value());
     }
 
     inline std::optional<std::string>
@@ -654,77 +1084,604 @@ namespace PQ
         return std::string(c_str);
     }
 
+
+    /**
+     * \brief Vectorized building blocks for the parsers and escapers of text literals below.
+     *
+     * Which instruction set is used is decided at compile time: AVX2 when compiling with `-mavx2` (or with a
+     * `-march` that implies it), SSE2 on any other x86-64, and plain byte-by-byte loops elsewhere.  The
+     * `…_scalar()` variants are always available, mostly so that they can be benchmarked against.
+     */
+    namespace simd
+    {
+        template<char... Cs>
+        inline const char *
+        find_any_scalar(const char *p, const char *end)
+        {
+            for (; p < end; p++)
+                if (((*p == Cs) or ...))
+                    return p;
+            return end;
+        }
+
+        /**
+         * The first of the characters `Cs` in `[p, end)`, or `end` if there are none.  Like `strpbrk()`, but
+         * for a fixed set of characters, with a known length, and without being thrown off by `NUL`s.
+         */
+        template<char... Cs>
+        inline const char *
+        find_any(const char *p, const char *end)
+        {
+#if defined(__AVX2__)
+            for (; end - p >= 32; p += 32)
+            {
+                const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+                const __m256i hits = (_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(Cs)) | ...);
+                const uint32_t mask = _mm256_movemask_epi8(hits);
+                if (mask)
+                    return p + __builtin_ctz(mask);
+            }
+#elif defined(__SSE2__)
+            for (; end - p >= 16; p += 16)
+            {
+                const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                const __m128i hits = (_mm_cmpeq_epi8(chunk, _mm_set1_epi8(Cs)) | ...);
+                const uint32_t mask = _mm_movemask_epi8(hits);
+                if (mask)
+                    return p + __builtin_ctz(mask);
+            }
+#endif
+            return find_any_scalar<Cs...>(p, end);
+        }
+
+        inline void
+        encode_hex_scalar(const unsigned char *in, size_t len, char *out)
+        {
+            static const char hex_digits[] = "0123456789abcdef";
+            for (size_t i = 0; i < len; i++)
+            {
+                *out++ = hex_digits[in[i] >> 4];
+                *out++ = hex_digits[in[i] & 0xF];
+            }
+        }
+
+#if defined(__SSE2__)
+        /**
+         * The lower-case hex digits for 16 nibbles (each in the low 4 bits of its byte).
+         */
+        inline __m128i
+        hex_digits_128(__m128i nibbles)
+        {
+            const __m128i is_letter = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+            return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')),
+                                _mm_and_si128(is_letter, _mm_set1_epi8('a' - '0' - 10)));
+        }
+#endif
+
+#if defined(__AVX2__)
+        inline __m256i
+        hex_digits_256(__m256i nibbles)
+        {
+            const __m256i is_letter = _mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9));
+            return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')),
+                                   _mm256_and_si256(is_letter, _mm256_set1_epi8('a' - '0' - 10)));
+        }
+#endif
+
+        /**
+         * Write the `2 * len` lower-case hex digits of the `len` bytes at `in` to `out`.
+         */
+        inline void
+        encode_hex(const unsigned char *in, size_t len, char *out)
+        {
+            size_t i = 0;
+#if defined(__AVX2__)
+            for (; len - i >= 32; i += 32, out += 64)
+            {
+                const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+                const __m256i low_nibbles = _mm256_set1_epi8(0x0F);
+                const __m256i high = hex_digits_256(_mm256_and_si256(_mm256_srli_epi16(bytes, 4), low_nibbles));
+                const __m256i low = hex_digits_256(_mm256_and_si256(bytes, low_nibbles));
+                // The unpacks interleave within each 128-bit lane, so the lanes have to be put back in order.
+                const __m256i first = _mm256_unpacklo_epi8(high, low);
+                const __m256i second = _mm256_unpackhi_epi8(high, low);
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(out),
+                                    _mm256_permute2x128_si256(first, second, 0x20));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 32),
+                                    _mm256_permute2x128_si256(first, second, 0x31));
+            }
+#endif
+#if defined(__SSE2__)
+            for (; len - i >= 16; i += 16, out += 32)
+            {
+                const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+                const __m128i low_nibbles = _mm_set1_epi8(0x0F);
+                const __m128i high = hex_digits_128(_mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibbles));
+                const __m128i low = hex_digits_128(_mm_and_si128(bytes, low_nibbles));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi8(high, low));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16), _mm_unpackhi_epi8(high, low));
+            }
+#endif
+            encode_hex_scalar(in + i, len - i, out);
+        }
+
+        /**
+         * The values of the hex digits, and `-1` for all other characters.
+         */
+        constexpr std::array<int8_t, 256>
+        hex_digit_values()
+        {
+            std::array<int8_t, 256> values{};
+            for (int c = 0; c < 256; c++)
+            {
+                if (c >= '0' and c <= '9')
+                    values[c] = c - '0';
+                else if (c >= 'a' and c <= 'f')
+                    values[c] = c - 'a' + 10;
+                else if (c >= 'A' and c <= 'F')
+                    values[c] = c - 'A' + 10;
+                else
+                    values[c] = -1;
+            }
+            return values;
+        }
+
+        /**
+         * Decode the `2 * len` hex digits at `in` into `len` bytes at `out`.  Returns `false` (having written
+         * an unspecified part of `out`) if there is anything else than hex digits at `in`.
+         */
+        inline bool
+        decode_hex_scalar(const char *in, size_t len, unsigned char *out)
+        {
+            static constexpr std::array<int8_t, 256> values = hex_digit_values();
+            const unsigned char *digits = reinterpret_cast<const unsigned char *>(in);
+            int8_t invalid = 0;
+            for (size_t i = 0; i < len; i++)
+            {
+                const int8_t high = values[digits[2 * i]];
+                const int8_t low = values[digits[2 * i + 1]];
+                invalid |= high | low;  // Only the `-1`s have their sign bit set.
+                out[i] = uint8_t(high) << 4 | uint8_t(low);
+            }
+            return invalid >= 0;
+        }
+
+#if defined(__SSE2__)
+        /**
+         * The values of 16 hex digits, with all bits of `valid` set for the bytes that are actual hex digits.
+         */
+        inline __m128i
+        hex_values_128(__m128i digits, __m128i &valid)
+        {
+            // There are no unsigned byte comparisons in SSE2, but `max(x, n) == n` means `x <= n`.
+            const __m128i decimal = _mm_sub_epi8(digits, _mm_set1_epi8('0'));
+            const __m128i is_decimal = _mm_cmpeq_epi8(_mm_max_epu8(decimal, _mm_set1_epi8(9)), _mm_set1_epi8(9));
+            const __m128i letter = _mm_sub_epi8(_mm_or_si128(digits, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+            const __m128i is_letter = _mm_cmpeq_epi8(_mm_max_epu8(letter, _mm_set1_epi8(5)), _mm_set1_epi8(5));
+            valid = _mm_or_si128(is_decimal, is_letter);
+            return _mm_or_si128(_mm_and_si128(is_decimal, decimal),
+                                _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+        }
+
+        /**
+         * Combine the 16 nibble values of 16 hex digits into (the low bytes of) 8 16-bit lanes.
+         */
+        inline __m128i
+        hex_pairs_128(__m128i values)
+        {
+            return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(values, _mm_set1_epi16(0x00FF)), 4),
+                                _mm_srli_epi16(values, 8));
+        }
+#endif
+
+#if defined(__AVX2__)
+        inline __m256i
+        hex_values_256(__m256i digits, __m256i &valid)
+        {
+            const __m256i decimal = _mm256_sub_epi8(digits, _mm256_set1_epi8('0'));
+            const __m256i is_decimal = _mm256_cmpeq_epi8(_mm256_max_epu8(decimal, _mm256_set1_epi8(9)),
+                                                         _mm256_set1_epi8(9));
+            const __m256i letter = _mm256_sub_epi8(_mm256_or_si256(digits, _mm256_set1_epi8(0x20)),
+                                                   _mm256_set1_epi8('a'));
+            const __m256i is_letter = _mm256_cmpeq_epi8(_mm256_max_epu8(letter, _mm256_set1_epi8(5)),
+                                                        _mm256_set1_epi8(5));
+            valid = _mm256_or_si256(is_decimal, is_letter);
+            return _mm256_or_si256(_mm256_and_si256(is_decimal, decimal),
+                                   _mm256_and_si256(is_letter, _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+        }
+
+        inline __m256i
+        hex_pairs_256(__m256i values)
+        {
+            return _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(values, _mm256_set1_epi16(0x00FF)), 4),
+                                   _mm256_srli_epi16(values, 8));
+        }
+#endif
+
+        inline bool
+        decode_hex(const char *in, size_t len, unsigned char *out)
+        {
+            size_t i = 0;
+#if defined(__AVX2__)
+            for (; len - i >= 32; i += 32)
+            {
+                __m256i valid_first, valid_second;
+                const __m256i first = hex_values_256(
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + 2 * i)), valid_first);
+                const __m256i second = hex_values_256(
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + 2 * i + 32)), valid_second);
+                if (_mm256_movemask_epi8(_mm256_and_si256(valid_first, valid_second)) != -1)
+                    return false;
+                // The pack works per 128-bit lane, leaving the 64-bit quarters in 0, 2, 1, 3 order.
+                const __m256i packed = _mm256_packus_epi16(hex_pairs_256(first), hex_pairs_256(second));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_permute4x64_epi64(packed, 0xD8));
+            }
+#endif
+#if defined(__SSE2__)
+            for (; len - i >= 16; i += 16)
+            {
+                __m128i valid_first, valid_second;
+                const __m128i first = hex_values_128(
+                        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2 * i)), valid_first);
+                const __m128i second = hex_values_128(
+                        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2 * i + 16)), valid_second);
+                if (_mm_movemask_epi8(_mm_and_si128(valid_first, valid_second)) != 0xFFFF)
+                    return false;
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                                 _mm_packus_epi16(hex_pairs_128(first), hex_pairs_128(second)));
+            }
+#endif
+            return decode_hex_scalar(in + 2 * i, len - i, out + i);
+        }
+
+        /**
+         * Append the contents of the double-quoted string of which the opening quote is just before `p` to
+         * `out`, dropping the backslashes that escape the characters following them.  Returns the position just
+         * after the closing quote.
+         */
+        inline const char *
+        unquote(const char *p, const char *end, std::string &out)
+        {
+            while (true)
+            {
+                const char *special = find_any<'"', '\\'>(p, end);
+                out.append(p, special - p);
+                if (special == end)
+                    throw std::invalid_argument("Unterminated quoted string.");
+                if (*special == '"')
+                    return special + 1;
+                if (special + 1 == end)
+                    throw std::invalid_argument("Unterminated quoted string.");
+                out.push_back(special[1]);
+                p = special + 2;
+            }
+        }
+
+        /**
+         * Append `unquoted` to `out` between double quotes, with a backslash before every `"` and `\`.
+         */
+        inline void
+        append_quoted(std::string &out, std::string_view unquoted)
+        {
+            const char *p = unquoted.data();
+            const char *const end = p + unquoted.size();
+
+            out.push_back('"');
+            while (true)
+            {
+                const char *special = find_any<'"', '\\'>(p, end);
+                out.append(p, special - p);
+                if (special == end)
+                    break;
+                out.push_back('\\');
+                out.push_back(*special);
+                p = special + 1;
+            }
+            out.push_back('"');
+        }
+    }
+
+    /**
+     * Convert a `bytea` to the `\x…` hex format.
+     */
+    inline std::string
+    as_hex_bytea(std::string_view bytes)
+    {
+        std::string hex(2 + 2 * bytes.size(), '\0');
+        hex[0] = '\\';
+        hex[1] = 'x';
+        simd::encode_hex(reinterpret_cast<const unsigned char *>(bytes.data()), bytes.size(), hex.data() + 2);
+        return hex;
+    }
+
+    inline std::string
+    double_quote(const std::string &unquoted)
+    {
+        std::string quoted;
+        quoted.reserve(unquoted.size() + 2);
+        simd::append_quoted(quoted, unquoted);
+        return quoted;
+    }
+
     /**
      * Convert a PostgreSQL array in text form to a vector of strings representing the array member values.
      *
+     * The elements of multi-dimensional arrays are flattened into the one vector, and unquoted `NULL` elements
+     * are taken for `"NULL"` strings.
+     *
      * We can deal with the string as single (ASCII) bytes, because of the beautiful elegance of UTF-8.
      */
     inline std::vector<std::string>
-    from_text_array(const std::string &input)
+    from_text_array(std::string_view input)
     {
         std::vector<std::string> result;
-        int depth = 0;
-        bool in_quotes = false;
-        std::string::size_type start_pos = 1;
-        std::string::size_type end_pos = 0;
-        std::string::size_type next_start_pos = 0;
 
-        assert(input.at(0) == '{');
-        assert(input.back() == '}');
+        if (input.size() < 2 or input.front() != '{' or input.back() != '}')
+            throw std::invalid_argument("Not an array: " + std::string(input));
 
-        for (std::string::size_type i = 0; i < input.size();)
+        const char *p = input.data();
+        const char *const end = p + input.size();
+        while (p < end)
         {
-            if (input.at(i) == '{' && not in_quotes)
+            if (*p == '{' or *p == '}' or *p == ',')
             {
-                if (++depth == 1)
-                {
-                    start_pos = i+1;
-                }
+                p++;
+                continue;
             }
-            else if (input.at(i) == '}' && not in_quotes)
+
+            std::string element;
+            if (*p == '"')
+                p = simd::unquote(p + 1, end, element);
+            else
             {
-                if (depth-- == 1 && end_pos == 0)
+                // Array output only quotes elements that contain special characters, but the input syntax
+                // also allows escaping them without quotes.
+                while (true)
                 {
-                    end_pos = i-1;
-                    next_start_pos = 0;
+                    const char *special = simd::find_any<',', '}', '\\'>(p, end);
+                    element.append(p, special - p);
+                    if (special == end or *special != '\\' or special + 1 == end)
+                    {
+                        p = special;
+                        break;
+                    }
+                    element.push_back(special[1]);
+                    p = special + 2;
                 }
             }
-            else if (input.at(i) == ',' && not in_quotes)
-            {
-                end_pos = i-1;
-                next_start_pos = i+1;
-            }
-            // We don't have to worry about `i-1 < 0`, because `input.at(0) == '{'`.
-            else if (input.at(i) == '"' && input.at(i-1) != '\\')
+            result.push_back(std::move(element));
+        }
+
+        return result;
+    }
+
+    /**
+     * Like `from_text_array()`, but for one-dimensional arrays only, and with unquoted `NULL` elements (which
+     * `from_text_array()` takes for `"NULL"` strings) as `std::nullopt`s.
+     */
+    inline std::vector<std::optional<std::string>>
+    from_text_array_with_nulls(std::string_view input)
+    {
+        std::vector<std::optional<std::string>> result;
+
+        if (input.size() < 2 or input.front() != '{' or input.back() != '}')
+            throw std::invalid_argument("Not a one-dimensional array: " + std::string(input));
+        if (input.size() == 2)
+            return result;
+
+        const char *p = input.data() + 1;
+        const char *const end = input.data() + input.size();
+        while (p < end)
+        {
+            std::string element;
+            bool quoted = false;
+            const char *special;
+            while (true)
             {
-                if (in_quotes)
+                special = simd::find_any<'"', '\\', ',', '{', '}'>(p, end);
+                element.append(p, special - p);
+                if (special == end)
+                    throw std::invalid_argument("Not a one-dimensional array: " + std::string(input));
+                else if (*special == '"')
                 {
-                    end_pos = i-1;
-                    next_start_pos = i+2;
-                    in_quotes = false;
+                    p = simd::unquote(special + 1, end, element);
+                    quoted = true;
                 }
-                else
+                else if (*special == '\\' and special + 1 < end)
                 {
-                    start_pos = i+1;
-                    in_quotes = true;
+                    element.push_back(special[1]);
+                    p = special + 2;
                 }
+                else if (*special == '{')
+                    throw std::invalid_argument("Not a one-dimensional array: " + std::string(input));
+                else
+                    break;
             }
 
-            if (start_pos > 0 and end_pos > 0)
-            {
-                std::string t = input.substr(start_pos, end_pos-start_pos+1);
-                t.erase(std::remove(t.begin(), t.end(), '\\'), t.end());
+            if (not quoted and strcasecmp(element.c_str(), "NULL") == 0)
+                result.push_back(std::nullopt);
+            else
+                result.push_back(std::move(element));
+            p = special + 1;
+        }
+
+        return result;
+    }
+
+    /**
+     * Reads the big-endian integers and length-prefixed values that the binary output (`…_send()`) functions of
+     * Postgres write, throwing rather than reading past the end of the value.
+     */
+    class binary_reader
+    {
+        const unsigned char *_pos;
+        const unsigned char *_end;
+
+        void need(size_t n) const
+        {
+            if (static_cast<size_t>(_end - _pos) < n)
+                throw std::invalid_argument("Binary value ends prematurely.");
+        }
 
-                result.push_back(t);
+    public:
+        binary_reader(const char *data, size_t len)
+            : _pos(reinterpret_cast<const unsigned char *>(data)),
+              _end(reinterpret_cast<const unsigned char *>(data) + len)
+        {
+        }
 
-                if (next_start_pos == 0) break;
+        uint32_t uint32()
+        {
+            need(4);
+            const uint32_t n = uint32_t(_pos[0]) << 24 | uint32_t(_pos[1]) << 16 | uint32_t(_pos[2]) << 8 | _pos[3];
+            _pos += 4;
+            return n;
+        }
 
-                end_pos = 0;
-                start_pos = next_start_pos;
-                i = start_pos;
-            }
-            else
-                i++;
+        int32_t int32()
+        {
+            return static_cast<int32_t>(uint32());
+        }
+
+        uint64_t uint64()
+        {
+            const uint64_t high = uint32();
+            return high << 32 | uint32();
+        }
+
+        std::string bytes(size_t n)
+        {
+            need(n);
+            std::string b(reinterpret_cast<const char *>(_pos), n);
+            _pos += n;
+            return b;
+        }
+
+        /**
+         * A value preceded by its `int4` length, which is `-1` for `NULL`.
+         */
+        std::optional<std::string> nullable_bytes()
+        {
+            const int32_t len = int32();
+            if (len < 0)
+                return std::nullopt;
+            return bytes(len);
+        }
+
+        bool at_end() const
+        {
+            return _pos == _end;
+        }
+    };
+
+    inline double
+    from_binary_float8(const char *data, size_t len)
+    {
+        if (len != 8)
+            throw std::invalid_argument("Binary `float8` should be 8 bytes, not " + std::to_string(len) + ".");
+        const uint64_t bits = binary_reader(data, len).uint64();
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+
+    /**
+     * A binary `bytea` is simply its bytes.
+     */
+    inline std::string
+    from_binary_bytea(const char *data, size_t len)
+    {
+        return std::string(data, len);
+    }
+
+    /**
+     * Unescape a `bytea` in text form (either in `hex` or in `escape` format).
+     */
+    inline std::string
+    from_text_bytea(std::string_view text)
+    {
+        if (text.size() >= 2 and text[0] == '\\' and text[1] == 'x' and text.size() % 2 == 0)
+        {
+            std::string decoded((text.size() - 2) / 2, '\0');
+            if (simd::decode_hex(text.data() + 2, decoded.size(), reinterpret_cast<unsigned char *>(decoded.data())))
+                return decoded;
+            // `PQunescapeBytea()` is more forgiving, by skipping whitespace (and other garbage) between the digits.
+        }
+
+        const std::string text_str(text);
+        size_t len = 0;
+        std::unique_ptr<unsigned char, decltype(&PQfreemem)> bytes(
+                PQunescapeBytea(reinterpret_cast<const unsigned char *>(text_str.c_str()), &len), &PQfreemem);
+        if (not bytes)
+            throw std::bad_alloc();
+        return std::string(reinterpret_cast<const char *>(bytes.get()), len);
+    }
+
+    /**
+     * Convert a binary, one-dimensional array of a type of which the binary form is the same as its text form
+     * (`text`, `varchar`, `name`) to a vector of its elements.
+     */
+    inline std::vector<std::optional<std::string>>
+    from_binary_array_with_nulls(const char *data, size_t len)
+    {
+        binary_reader reader(data, len);
+        std::vector<std::optional<std::string>> result;
+
+        const int32_t ndim = reader.int32();
+        reader.int32();  // Whether the array has `NULL`s.
+        reader.uint32();  // The element type OID.
+        if (ndim == 0)
+            return result;
+        if (ndim != 1)
+            throw std::invalid_argument("Not a one-dimensional array: " + std::to_string(ndim) + " dimensions");
+
+        const int32_t nelems = reader.int32();
+        reader.int32();  // The lower bound.
+        if (nelems < 0)
+            throw std::invalid_argument("Negative array dimension: " + std::to_string(nelems));
+
+        result.reserve(std::min<size_t>(nelems, len / 4));
+        for (int32_t i = 0; i < nelems; i++)
+            result.push_back(reader.nullable_bytes());
+
+        return result;
+    }
+
+    /**
+     * Like `from_binary_array_with_nulls()`, for arrays that must not contain `NULL`s.
+     */
+    inline std::vector<std::string>
+    from_binary_array(const char *data, size_t len)
+    {
+        std::vector<std::string> result;
+        for (std::optional<std::string> &element : from_binary_array_with_nulls(data, len))
+        {
+            if (not element)
+                throw std::invalid_argument("Unexpected `NULL` element in array.");
+            result.push_back(std::move(element.value()));
+        }
+        return result;
+    }
+
+    /**
+     * Convert a binary `hstore` (as written by `hstore_send()`) to an `unordered_map` of its items.
+     */
+    inline std::unordered_map<std::string, std::optional<std::string>>
+    from_binary_hstore(const char *data, size_t len)
+    {
+        binary_reader reader(data, len);
+        std::unordered_map<std::string, std::optional<std::string>> result;
+
+        const int32_t count = reader.int32();
+        if (count < 0)
+            throw std::invalid_argument("Negative `hstore` item count: " + std::to_string(count));
+
+        for (int32_t i = 0; i < count; i++)
+        {
+            std::optional<std::string> key = reader.nullable_bytes();
+            if (not key)
+                throw std::invalid_argument("Unexpected `NULL` key in `hstore`.");
+            result[key.value()] = reader.nullable_bytes();
         }
 
         return result;
@@ -899,71 +1856,46 @@ namespace PQ
         return result;
     }
 
-    inline std::string
-    unescape_hstore_text(const std::string &escaped)
-    {
-        std::string unescaped("");
-        for (std::string::size_type i = 0; i < escaped.size(); ++i)
-        {
-            // Skip past the escape character, unless it is the _escaped_ escaped character itself.
-            if (escaped[i] == '\\' and (i == 0 or escaped[i-1] != '\\')) i++;
-
-            unescaped.push_back(escaped[i]);
-        }
-        return unescaped;
-    }
-
     /**
      * Parse Postgres `hstore` string to an `unordered_map` of each item in the `hstore`.
+     *
+     * Only the `hstore` output syntax is understood: the keys and the non-`NULL` values are always quoted.
      */
     inline std::unordered_map<std::string, std::optional<std::string>>
-    from_text_hstore(const std::string &input)
+    from_text_hstore(std::string_view input)
     {
         std::unordered_map<std::string, std::optional<std::string>> result;
 
-        bool in_quotes = false;
-        std::string::size_type key_start, key_end, val_start, val_end;
-        key_start = key_end = val_start = val_end = 0;
-
-        for (std::string::size_type i = 0; i < input.size(); ++i)
+        const char *p = input.data();
+        const char *const end = p + input.size();
+        while (true)
         {
-            if (input[i] == '"' and (i == 0 or input[i-1] != '\\'))
+            p = simd::find_any<'"'>(p, end);
+            if (p == end)
+                break;
+
+            std::string key;
+            p = simd::unquote(p + 1, end, key);
+
+            if (end - p < 2 or p[0] != '=' or p[1] != '>')
+                throw std::invalid_argument("Expected `=>` after `hstore` key: " + key);
+            p += 2;
+            while (p < end and *p == ' ')
+                p++;
+
+            if (p < end and *p == '"')
             {
-                in_quotes = not in_quotes;
-                if (in_quotes)
-                {
-                    if (key_start == 0)
-                    {
-                        key_start = i+1;
-                    }
-                    else if (val_start == 0)
-                    {
-                        val_start = i+1;
-                    }
-                }
-                else
-                {
-                    if (key_end == 0)
-                    {
-                        key_end = i-1;
-                    }
-                    else if (val_end == 0)
-                    {
-                        val_end = i-1;
-                        const std::string raw_val = input.substr(val_start, val_end-val_start+1);
-                        result[input.substr(key_start, key_end-key_start+1)] = (
-                            strcasecmp(raw_val.c_str(), "NULL") != 0
-                            ? std::optional(unescape_hstore_text(raw_val))
-                            : std::nullopt
-                        );
-                        key_start = key_end = val_start = val_end = 0;
-                    }
-                }
+                std::string value;
+                p = simd::unquote(p + 1, end, value);
+                result[std::move(key)] = std::move(value);
             }
-            else if ((not in_quotes) && input[i] == '=' && input[i+1] == '>')
+            else if (end - p >= 4 and strncasecmp(p, "NULL", 4) == 0)
             {
-                ++i;
+                result[std::move(key)] = std::nullopt;
+                p += 4;
             }
+            else
+                throw std::invalid_argument("Expected a quoted value or `NULL` for `hstore` key: " + key);
         }
 
         return result;
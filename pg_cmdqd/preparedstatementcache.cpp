@@ -0,0 +1,65 @@
+#include "preparedstatementcache.h"
+
+PreparedStatementCache::PreparedStatementCache(size_t capacity)
+    : _capacity(capacity)
+{
+}
+
+size_t PreparedStatementCache::capacity() const
+{
+    return _capacity;
+}
+
+void PreparedStatementCache::set_capacity(size_t capacity)
+{
+    // If the cache is now over capacity, it will shrink as new statements are prepared.
+    _capacity = capacity;
+}
+
+size_t PreparedStatementCache::size() const
+{
+    return _lru.size();
+}
+
+void PreparedStatementCache::forget_other_sessions(const std::shared_ptr<PG::conn> &conn)
+{
+    // After a `PQreset()`, the `PGconn` is the same, but the backend (and thus the session) is not.
+    if (conn->get() == _raw_conn and PQbackendPID(conn->get()) == _backend_pid)
+        return;
+
+    _lru.clear();
+    _by_sql.clear();
+    _raw_conn = conn->get();
+    _backend_pid = PQbackendPID(conn->get());
+}
+
+std::shared_ptr<PG::result> PreparedStatementCache::prepare(
+        const std::shared_ptr<PG::conn> &conn, const std::string &sql, std::string &stmt_name)
+{
+    forget_other_sessions(conn);
+
+    auto found = _by_sql.find(sql);
+    if (found != _by_sql.end())
+    {
+        _lru.splice(_lru.begin(), _lru, found->second);
+        stmt_name = found->second->second;
+        return nullptr;
+    }
+
+    while (not _lru.empty() and _lru.size() >= _capacity)
+    {
+        PQ::exec(conn, "DEALLOCATE " + _lru.back().second);
+        _by_sql.erase(_lru.back().first);
+        _lru.pop_back();
+    }
+
+    stmt_name = "cmd_sql_" + std::to_string(++_statements_prepared);
+    std::shared_ptr<PG::result> result = PQ::prepare(conn, stmt_name, sql);
+    if (PQ::resultStatus(*result) != PGRES_COMMAND_OK)
+        return result;
+
+    _lru.emplace_front(sql, stmt_name);
+    _by_sql[sql] = _lru.begin();
+
+    return nullptr;
+}
@@ -0,0 +1,52 @@
+#ifndef PREPAREDSTATEMENTCACHE_H
+#define PREPAREDSTATEMENTCACHE_H
+
+#include <stddef.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "pq-raii/libpq-raii.hpp"
+
+/**
+ * Keeps track of the `cmd_sql` statements that have been `PREPARE`d on a connection, so that a statement
+ * that is run over and over again, with different `cmd_sql_params`, is only parsed once.
+ *
+ * When the cache is full, the least recently used statement is `DEALLOCATE`d to make room.  When the
+ * connection has been reset (or replaced) since the last call, the cache starts out empty again, because
+ * prepared statements don't outlive the session.
+ */
+class PreparedStatementCache
+{
+    typedef std::list<std::pair<std::string, std::string>> lru_list;  // (SQL, statement name) pairs
+
+    size_t _capacity;
+    PGconn *_raw_conn = nullptr;
+    int _backend_pid = 0;
+    lru_list _lru;  // Most recently used first.
+    std::unordered_map<std::string, lru_list::iterator> _by_sql;
+    unsigned long _statements_prepared = 0;
+
+    void forget_other_sessions(const std::shared_ptr<PG::conn> &conn);
+
+public:
+    PreparedStatementCache(size_t capacity = 0);
+
+    size_t capacity() const;
+    void set_capacity(size_t capacity);
+
+    /**
+     * Look up the name of the prepared statement for `sql`, preparing it first if it's not in the cache.
+     *
+     * Returns `nullptr` (with `stmt_name` set) if the statement is ready, or the `PG::result` of the failed
+     * `PQprepare()`.
+     */
+    std::shared_ptr<PG::result> prepare(
+            const std::shared_ptr<PG::conn> &conn, const std::string &sql, std::string &stmt_name);
+
+    size_t size() const;
+};
+
+#endif // PREPAREDSTATEMENTCACHE_H
@@ -0,0 +1,119 @@
+#include "processlimits.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const int IOPRIO_WHO_PROCESS = 1;
+static const int IOPRIO_CLASS_SHIFT = 13;
+
+ProcessLimits::ProcessLimits(const CmdQueue &cmd_queue)
+{
+    if (cmd_queue.queue_rlimit_as_bytes)
+        rlimit_as_bytes = cmd_queue.queue_rlimit_as_bytes.value();
+    if (cmd_queue.queue_rlimit_cpu_sec)
+        rlimit_cpu_sec = cmd_queue.queue_rlimit_cpu_sec.value();
+    if (cmd_queue.queue_rlimit_nofile)
+        rlimit_nofile = cmd_queue.queue_rlimit_nofile.value();
+    nice = cmd_queue.queue_cmd_nice;
+
+    if (cmd_queue.queue_cmd_ioprio_class == "realtime")
+        ioprio_class = 1;
+    else if (cmd_queue.queue_cmd_ioprio_class == "best-effort")
+        ioprio_class = 2;
+    else if (cmd_queue.queue_cmd_ioprio_class == "idle")
+        ioprio_class = 3;
+    if (cmd_queue.queue_cmd_ioprio_level)
+        ioprio_level = cmd_queue.queue_cmd_ioprio_level.value();
+
+    cpu_set = cmd_queue.queue_cpu_set;
+#if defined(SCHED_BATCH) and defined(SCHED_IDLE)
+    if (cmd_queue.queue_sched_policy == "batch")
+        sched_policy = SCHED_BATCH;
+    else if (cmd_queue.queue_sched_policy == "idle")
+        sched_policy = SCHED_IDLE;
+#endif
+}
+
+static bool set_rlimit(int resource, rlim_t soft, rlim_t hard)
+{
+    const struct rlimit rlim = { soft, hard };
+    return setrlimit(resource, &rlim) == 0;
+}
+
+const char *ProcessLimits::apply() const noexcept
+{
+    if (rlimit_as_bytes and not set_rlimit(RLIMIT_AS, rlimit_as_bytes.value(), rlimit_as_bytes.value()))
+        return "setrlimit(RLIMIT_AS)";
+
+    // The hard limit is a second above the soft limit, so that the process first gets a `SIGXCPU`.
+    if (rlimit_cpu_sec and not set_rlimit(RLIMIT_CPU, rlimit_cpu_sec.value(), rlimit_cpu_sec.value() + 1))
+        return "setrlimit(RLIMIT_CPU)";
+
+    if (rlimit_nofile and not set_rlimit(RLIMIT_NOFILE, rlimit_nofile.value(), rlimit_nofile.value()))
+        return "setrlimit(RLIMIT_NOFILE)";
+
+    if (nice and setpriority(PRIO_PROCESS, 0, nice.value()) < 0)
+        return "setpriority()";
+
+#ifdef SYS_ioprio_set
+    if (ioprio_class
+        and syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, (ioprio_class.value() << IOPRIO_CLASS_SHIFT) | ioprio_level) < 0)
+        return "ioprio_set()";
+#endif
+
+    return nullptr;
+}
+
+const char *ProcessLimits::apply_cpu_scheduling() const noexcept
+{
+#ifdef _GNU_SOURCE
+    if (not cpu_set.empty())
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (const int cpu : cpu_set)
+        {
+            if (cpu >= 0 and cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &cpus);
+        }
+
+        const int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err != 0)
+        {
+            errno = err;
+            return "pthread_setaffinity_np()";
+        }
+    }
+#endif
+
+    if (sched_policy)
+    {
+        // Neither `SCHED_BATCH` nor `SCHED_IDLE` has a static priority other than 0.
+        const struct sched_param param = { 0 };
+        const int err = pthread_setschedparam(pthread_self(), sched_policy.value(), &param);
+        if (err != 0)
+        {
+            errno = err;
+            return "pthread_setschedparam()";
+        }
+    }
+
+    return nullptr;
+}
+
+bool ProcessLimits::killed_by_cpu_limit(int term_sig, const struct rusage &rusage) const
+{
+    if (not rlimit_cpu_sec)
+        return false;
+    if (term_sig == SIGXCPU)
+        return true;
+    if (term_sig != SIGKILL)
+        return false;
+
+    const rlim_t cpu_sec = rusage.ru_utime.tv_sec + rusage.ru_stime.tv_sec;
+    return cpu_sec >= rlimit_cpu_sec.value();
+}
@@ -0,0 +1,57 @@
+#ifndef PROCESSLIMITS_H
+#define PROCESSLIMITS_H
+
+#include <sys/resource.h>
+
+#include <optional>
+#include <vector>
+
+#include "cmdqueue.h"
+
+/**
+ * The resource limits, CPU affinity and CPU and I/O priority of the processes that a queue runner starts, as
+ * configured by the `queue_rlimit_*`, `queue_cmd_nice`, `queue_cmd_ioprio_*`, `queue_cpu_set` and
+ * `queue_sched_policy` columns of the `cmd_queue`.
+ *
+ * Everything is converted to plain numbers up front, so that `apply()` can be called in a `fork()`ed child
+ * process, where we mustn't allocate.
+ */
+class ProcessLimits
+{
+public:
+    std::optional<rlim_t> rlimit_as_bytes;
+    std::optional<rlim_t> rlimit_cpu_sec;
+    std::optional<rlim_t> rlimit_nofile;
+    std::optional<int> nice;
+    std::optional<int> ioprio_class;  // One of the kernel's `IOPRIO_CLASS_*` numbers.
+    int ioprio_level = 4;             // The kernel's default level within the best-effort class.
+    std::vector<int> cpu_set;         // Empty if the CPU affinity is to be left alone.
+    std::optional<int> sched_policy;  // `SCHED_BATCH` or `SCHED_IDLE`.
+
+    ProcessLimits() = default;
+    ProcessLimits(const CmdQueue &cmd_queue);
+
+    /**
+     * Apply the limits and priorities to the calling process.  Returns the name of the system call that
+     * failed (with `errno` set), or `nullptr` if everything went well.
+     */
+    const char *apply() const noexcept;
+
+    /**
+     * Confine the calling _thread_ to the `cpu_set` and give it the `sched_policy`.  Every process that the
+     * thread starts inherits both, which is why `apply()` doesn't have to bother with them.  Returns the name
+     * of the call that failed (with `errno` set), or `nullptr`.
+     */
+    const char *apply_cpu_scheduling() const noexcept;
+
+    /**
+     * Whether a process that was killed by `term_sig` has been stopped by its `rlimit_cpu_sec`.
+     *
+     * The kernel sends `SIGXCPU` when the soft limit is reached.  A process that ignores or handles `SIGXCPU`
+     * is `SIGKILL`ed a second later, when it reaches the hard limit, which is why the CPU time has to be
+     * looked at as well.
+     */
+    bool killed_by_cpu_limit(int term_sig, const struct rusage &rusage) const;
+};
+
+#endif // PROCESSLIMITS_H
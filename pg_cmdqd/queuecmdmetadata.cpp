@@ -1,25 +1,33 @@
 #include "queuecmdmetadata.h"
 
+#include <stdlib.h>
+
 #include <chrono>
 
 #include "pq-raii/libpq-raii.hpp"
 
 
-QueueCmdMetadata::QueueCmdMetadata(
-        const PG::result &result,
-        int row_number,
-        const std::unordered_map<std::string, int> &field_numbers
-    ) noexcept
+QueueCmdMetadata::QueueCmdMetadata(const PG::row &row, const ColumnNumbers &columns) noexcept
 {
     try
     {
-        cmd_class_identity = PQ::getvalue(result, row_number, field_numbers.at("cmd_class_identity"));
+        cmd_class_identity = row.value(columns[CMD_CLASS_IDENTITY]);
+
+        cmd_class_relname = row.value(columns[CMD_CLASS_RELNAME]);
 
-        cmd_class_relname = PQ::getvalue(result, row_number, field_numbers.at("cmd_class_relname"));
+        cmd_id = row.value(columns[CMD_ID]);
 
-        cmd_id = PQ::getvalue(result, row_number, field_numbers.at("cmd_id"));
+        if (std::optional<std::string_view> subid = row.nullable(columns[CMD_SUBID]))
+            cmd_subid.emplace(subid.value());
 
-        cmd_subid = PQ::getnullable(result, row_number, field_numbers.at("cmd_subid"));
+        const int cmd_queued_since_field = columns[CMD_QUEUED_SINCE];
+        const std::string_view raw_cmd_queued_since = row.value(cmd_queued_since_field);
+        if (row.isnull(cmd_queued_since_field))
+            cmd_queued_since = 0;
+        else if (row.format(cmd_queued_since_field) == 1)
+            cmd_queued_since = PQ::from_binary_float8(raw_cmd_queued_since.data(), raw_cmd_queued_since.size());
+        else
+            cmd_queued_since = strtod(raw_cmd_queued_since.data(), nullptr);  // The view is `NUL`-terminated.
 
         _is_valid = true;
     }
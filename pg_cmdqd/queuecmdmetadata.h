@@ -3,7 +3,6 @@
 
 #include <optional>
 #include <string>
-#include <unordered_map>
 
 #include "pq-raii/libpq-raii.hpp"
 #include "cmdqueue.h"
@@ -17,6 +16,27 @@ protected:
     bool _is_valid = false;
 
 public:
+    /**
+     * The columns of a queue command's `SELECT` result that go into its metadata.  Command classes put their
+     * own columns after these; see `NixQueueCmd::Column`.
+     */
+    enum Column
+    {
+        CMD_CLASS_IDENTITY,
+        CMD_CLASS_RELNAME,
+        CMD_ID,
+        CMD_SUBID,
+        CMD_QUEUED_SINCE,
+    };
+    static constexpr PG::column_names<5> COLUMNS = {
+        "cmd_class_identity",
+        "cmd_class_relname",
+        "cmd_id",
+        "cmd_subid",
+        "cmd_queued_since",
+    };
+    typedef PG::column_numbers<COLUMNS.size()> ColumnNumbers;
+
     std::string cmd_class_identity;
     std::string cmd_class_relname;
     std::string cmd_id;
@@ -28,11 +48,7 @@ public:
     double cmd_runtime_end;
 
     QueueCmdMetadata() = delete;
-    QueueCmdMetadata(
-            const PG::result &result,
-            int row_number,
-            const std::unordered_map<std::string, int> &fieldMapping
-        ) noexcept;
+    QueueCmdMetadata(const PG::row &row, const ColumnNumbers &columns) noexcept;
     QueueCmdMetadata(
         const std::string &cmd_class_identity,
         const std::string &cmd_class_relname,
@@ -1,9 +1,14 @@
 #include "sqlqueuecmd.h"
 
+#include <errno.h>
+#include <poll.h>
+
+#include <algorithm>
+#include <chrono>
 #include <functional>
-#include <regex>
 
 #include "pq-raii/libpq-raii.hpp"
+#include "jsonrowsencoder.h"
 #include "utils.h"
 
 /*
@@ -13,24 +18,21 @@ std::string SqlQueueCmd::select::notify(const CmdQueue &cmd_queue)
 }
 */
 
-std::vector<std::optional<std::string>> SqlQueueCmd::update_params() const
+void SqlQueueCmd::bind_update_params(PG::params &params) const
 {
-    std::vector<std::optional<std::string>> params;
-    params.reserve(8);
-
-    params.push_back(meta.cmd_id);
-    params.push_back(meta.cmd_subid);
-    params.push_back(formatString("%f", meta.cmd_runtime_start));
-    params.push_back(formatString("%f", meta.cmd_runtime_end));
-    params.push_back(cmd_sql_result_status);
-    params.push_back(std::string("null"));
+    params.bind_text(meta.cmd_id);
+    params.bind_text(meta.cmd_subid);
+    params.bind_printf("%f", meta.cmd_runtime_start);
+    params.bind_printf("%f", meta.cmd_runtime_end);
+    params.bind_text(cmd_sql_result_status);
+    params.bind_text(cmd_sql_result_rows);
 
     if (cmd_sql_fatal_error)
-        params.push_back(
+        params.bind_copy(
             PQ::as_text_composite_value(
                 PQ::values_to_vector<char, std::optional<std::string>>(cmd_sql_fatal_error.value())));
     else
-        params.push_back(std::nullopt);
+        params.bind_null();
 
     {
         std::vector<std::string> composite_values;
@@ -40,29 +42,14 @@ std::vector<std::optional<std::string>> SqlQueueCmd::update_params() const
             composite_values.push_back(PQ::as_text_composite_value(
                         PQ::values_to_vector<char, std::optional<std::string>>(err)));
         }
-        params.push_back(PQ::as_text_array(composite_values));
+        params.bind_copy(PQ::as_text_array(composite_values));
     }
-
-    return params;
-}
-
-std::vector<int> SqlQueueCmd::update_param_lengths() const
-{
-    return {};
 }
 
-std::vector<int> SqlQueueCmd::update_param_formats() const
+SqlQueueCmd::SqlQueueCmd(const PG::row &row, const ColumnNumbers &columns) noexcept
+    : meta(row, columns.head<QueueCmdMetadata::COLUMNS.size()>())
 {
-    return {};
-}
-
-SqlQueueCmd::SqlQueueCmd(
-        const PG::result &result,
-        int row,
-        const std::unordered_map<std::string, int> &fieldMapping) noexcept
-    : meta(result, row, fieldMapping)
-{
-    static std::regex leading_and_trailing_whitespace("^[\n\t ]+|[\n\t ]+$");
+    static const char *leading_and_trailing_whitespace = "\n\t ";
 
     if (not meta.is_valid()) {
         _is_valid = false;
@@ -70,10 +57,26 @@ SqlQueueCmd::SqlQueueCmd(
 
     try
     {
-        if (PQ::getisnull(result, row, fieldMapping.at("cmd_sql")))
+        if (row.isnull(columns[CMD_SQL]))
             throw std::domain_error("`cmd_sql` should never be `NULL`.");
-        this->cmd_sql = PQ::getvalue(result, row, fieldMapping.at("cmd_sql"));
-        this->cmd_sql = std::regex_replace(this->cmd_sql, leading_and_trailing_whitespace, "");
+        std::string_view raw_cmd_sql = row.value(columns[CMD_SQL]);
+        const std::string_view::size_type first = raw_cmd_sql.find_first_not_of(leading_and_trailing_whitespace);
+        if (first == std::string_view::npos)
+            raw_cmd_sql = std::string_view();
+        else
+            raw_cmd_sql = raw_cmd_sql.substr(
+                    first, raw_cmd_sql.find_last_not_of(leading_and_trailing_whitespace) - first + 1);
+        this->cmd_sql = raw_cmd_sql;
+
+        const int cmd_sql_params_field = columns[CMD_SQL_PARAMS];
+        const std::string_view raw_cmd_sql_params = row.value(cmd_sql_params_field);
+        if (row.isnull(cmd_sql_params_field))
+            ;
+        else if (row.format(cmd_sql_params_field) == 1)
+            this->cmd_sql_params = PQ::from_binary_array_with_nulls(
+                    raw_cmd_sql_params.data(), raw_cmd_sql_params.size());
+        else
+            this->cmd_sql_params = PQ::from_text_array_with_nulls(raw_cmd_sql_params);
     }
     catch (std::exception &ex)
     {
@@ -110,10 +113,217 @@ SqlQueueCmd::handle_sql_fatality(const PG::result &result)
     return PQ::resultErrorFields(result);
 }
 
-void SqlQueueCmd::run_cmd(std::shared_ptr<PG::conn> &conn, const double queue_cmd_timeout_sec)
+bool SqlQueueCmd::send_cmd_sql(std::shared_ptr<PG::conn> &conn, RunnerState &runner_state)
+{
+    // Without `cmd_sql_params`, `cmd_sql` may consist of multiple statements, which only the simple query
+    // protocol allows for.
+    if (not cmd_sql_params)
+        return PQ::sendQuery(conn, cmd_sql);
+
+    PG::params &params = runner_state.cmd_sql_params;
+    params.clear();
+    for (const std::optional<std::string> &param : cmd_sql_params.value())
+        params.bind_text(param);
+
+    if (runner_state.prepared_cmd_sql.capacity() == 0)
+        return PQ::sendQueryParams(conn, cmd_sql, params);
+
+    std::string stmt_name;
+    std::shared_ptr<PG::result> prepare_result = runner_state.prepared_cmd_sql.prepare(conn, cmd_sql, stmt_name);
+    if (prepare_result)
+    {
+        cmd_sql_result_status = PQresStatus(PQ::resultStatus(*prepare_result));
+        cmd_sql_fatal_error = handle_sql_fatality(*prepare_result);
+        return false;
+    }
+
+    return PQ::sendQueryPrepared(conn, stmt_name, params);
+}
+
+bool SqlQueueCmd::wait_for_input(
+        std::shared_ptr<PG::conn> &conn,
+        const std::optional<std::chrono::steady_clock::time_point> &deadline,
+        int kill_fd)
+{
+    int timeout_ms = -1;
+    if (deadline and not _cancel_status)
+    {
+        timeout_ms = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline.value() - std::chrono::steady_clock::now()).count());
+    }
+
+    // `poll()` ignores negative FDs; once we've asked to cancel, we no longer have to watch the kill pipe,
+    // which the `CmdQueueRunner` still has to read from itself.
+    struct pollfd fds[] = {
+        { PQ::socket(conn), POLLIN, 0 },
+        { _cancel_status ? -1 : kill_fd, POLLIN, 0 },
+    };
+
+    const int fd_count = poll(fds, 2, timeout_ms);
+    if (fd_count < 0)
+        return errno == EINTR;
+
+    if (fd_count == 0 or fds[1].revents != 0)
+    {
+        _cancel_status = fd_count == 0 ? "CMDQD_TIMEOUT" : "CMDQD_CANCELED";
+        logger->log(
+            LOG_ERROR, "cmd_id = '%s'%s: %s; canceling it",
+            meta.cmd_id.c_str(),
+            meta.cmd_subid ? std::string(" (cmd_subid = '" + meta.cmd_subid.value() + "')").c_str() : "",
+            fd_count == 0 ? "`queue_cmd_timeout` exceeded" : "runner asked to stop"
+        );
+
+        char errbuf[256];
+        std::unique_ptr<PGcancel, decltype(&PQfreeCancel)> cancel(PQgetCancel(conn->get()), &PQfreeCancel);
+        if (not cancel or not PQcancel(cancel.get(), errbuf, sizeof(errbuf)))
+            logger->log(LOG_ERROR, "Could not send cancel request: %s", cancel ? errbuf : "PQgetCancel() failed");
+    }
+
+    if (fds[0].revents != 0 and not PQ::consumeInput(conn))
+        return false;
+
+    return true;
+}
+
+void SqlQueueCmd::exec_cmd_sql(std::shared_ptr<PG::conn> &conn, const CmdQueue &cmd_queue, RunnerState &runner_state)
+{
+    if (not send_cmd_sql(conn, runner_state))
+    {
+        if (not cmd_sql_fatal_error)
+        {
+            PG::result result(PQmakeEmptyPGresult(conn->get(), PGRES_FATAL_ERROR));
+            cmd_sql_result_status = PQresStatus(PGRES_FATAL_ERROR);
+            cmd_sql_fatal_error = handle_sql_fatality(result);
+        }
+        return;
+    }
+
+    // Instead of waiting for the complete result to be buffered in a `PGresult`, we encode the rows as they come
+    // in, and forget about them right after.
+#ifdef LIBPQ_HAS_CHUNK_MODE
+    PQ::setChunkedRowsMode(conn, 1000);
+#else
+    PQ::setSingleRowMode(conn);
+#endif
+
+    JsonRowsEncoder rows_encoder(cmd_queue.queue_max_result_rows, cmd_queue.queue_max_result_bytes);
+    bool has_result_set = false;
+
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    if (cmd_queue.queue_cmd_timeout_sec > 0)
+        deadline = std::chrono::steady_clock::now()
+                   + std::chrono::microseconds(static_cast<int64_t>(cmd_queue.queue_cmd_timeout_sec * 1e6));
+
+    // Like `PQexec()`, we keep the status of the last statement in `cmd_sql`; but the rows of all its statements.
+    while (true)
+    {
+        // Rather than blocking in `PQgetResult()`, we wait for the result ourselves, so that we can cancel the
+        // command if it takes too long, or if the runner is asked to stop.
+        while (PQisBusy(conn->get()))
+        {
+            if (not wait_for_input(conn, deadline, runner_state.kill_fd))
+                break;
+        }
+
+        PG::result result = PQ::getResult(conn);
+        if (not result.get())
+            break;
+
+        const ExecStatusType exec_status = PQ::resultStatus(result);
+        switch (exec_status)
+        {
+#ifdef LIBPQ_HAS_CHUNK_MODE
+            case PGRES_TUPLES_CHUNK:
+#endif
+            case PGRES_SINGLE_TUPLE:
+                rows_encoder.append_rows(result);
+                has_result_set = true;
+                break;
+            case PGRES_TUPLES_OK:
+                // Contains no rows in single-row or chunked mode; _all_ the rows if that mode couldn't be set.
+                rows_encoder.append_rows(result);
+                rows_encoder.start_result_set();
+                has_result_set = true;
+                cmd_sql_result_status = PQresStatus(exec_status);
+                break;
+            case PGRES_COMMAND_OK:
+            case PGRES_EMPTY_QUERY:
+                rows_encoder.start_result_set();
+                cmd_sql_result_status = PQresStatus(exec_status);
+                break;
+            case PGRES_COPY_IN:
+            {
+                int copy_end_status;
+                while ((copy_end_status = PQputCopyEnd(conn->get(), "`COPY FROM STDIN` is not supported in `cmd_sql`.")) == 0)
+                {
+                    // Only happens on a non-blocking connection whose output buffer is full.
+                    struct pollfd fd = { PQ::socket(conn), POLLOUT, 0 };
+                    if (poll(&fd, 1, -1) < 0 and errno != EINTR)
+                    {
+                        copy_end_status = -1;
+                        break;
+                    }
+                }
+                if (copy_end_status < 0 and not cmd_sql_fatal_error)
+                {
+                    PG::result copy_end_result(PQmakeEmptyPGresult(conn->get(), PGRES_FATAL_ERROR));
+                    cmd_sql_result_status = PQresStatus(PGRES_FATAL_ERROR);
+                    cmd_sql_fatal_error = handle_sql_fatality(copy_end_result);
+                }
+                break;
+            }
+            case PGRES_COPY_OUT:
+            {
+                // The data is thrown away; the status of the `COPY` follows once all of it has been read.
+                char *buf;
+                int len;
+                while ((len = PQgetCopyData(conn->get(), &buf, 1)) >= 0)
+                {
+                    if (len > 0)
+                        PQfreemem(buf);
+                    else if (not wait_for_input(conn, deadline, runner_state.kill_fd))
+                        break;
+                }
+                break;
+            }
+            default:
+                cmd_sql_result_status = PQresStatus(exec_status);
+                if (not cmd_sql_fatal_error)
+                    cmd_sql_fatal_error = handle_sql_fatality(result);
+        }
+    }
+
+    // If the command was done before our cancel request arrived, we're happy to take its result.
+    if (_cancel_status and cmd_sql_fatal_error
+        and cmd_sql_fatal_error.value()[PG_DIAG_SQLSTATE] == std::string("57014"))  // `query_canceled`
+    {
+        cmd_sql_result_status = _cancel_status.value();
+    }
+
+    if (cmd_sql_fatal_error)
+        return;
+
+    if (has_result_set)
+        cmd_sql_result_rows = rows_encoder.finish();
+
+    if (rows_encoder.rows_dropped() > 0)
+    {
+        logger->log(
+            LOG_WARNING, "cmd_id = '%s'%s: kept %zu result rows; %zu more did not fit within the queue's limits",
+            meta.cmd_id.c_str(),
+            meta.cmd_subid ? std::string(" (cmd_subid = '" + meta.cmd_subid.value() + "')").c_str() : "",
+            rows_encoder.rows(),
+            rows_encoder.rows_dropped()
+        );
+    }
+}
+
+void SqlQueueCmd::run_cmd(std::shared_ptr<PG::conn> &conn, const CmdQueue &cmd_queue, RunnerState &runner_state)
 {
     // TODO: Check connection viability
 
+    runner_state.prepared_cmd_sql.set_capacity(cmd_queue.queue_cmd_sql_cache_size);
+
     PQnoticeReceiver old_receiver = PQsetNoticeReceiver(conn->get(),
                                                         SqlQueueCmd::receive_notice_c_wrapper,
                                                         nullptr);
@@ -142,19 +352,8 @@ void SqlQueueCmd::run_cmd(std::shared_ptr<PG::conn> &conn, const double queue_cm
 
     if (not _sql_bookkeeping_has_failed)
     {
-        PG::result result = PQ::exec(conn, cmd_sql.c_str());
-        ExecStatusType exec_status = PQ::resultStatus(result);
-        cmd_sql_result_status = PQresStatus(exec_status);
-        if (exec_status == PGRES_TUPLES_OK)
-        {
-            // TODO: retrieve rows
-        }
-        else if (exec_status == PGRES_COMMAND_OK) {}
-        else
-        {
-            _sql_cmd_itself_has_failed = true;
-            cmd_sql_fatal_error = handle_sql_fatality(result);
-        }
+        exec_cmd_sql(conn, cmd_queue, runner_state);
+        _sql_cmd_itself_has_failed = cmd_sql_fatal_error.has_value();
     }
 
     // If no error occured yet, let's see what happens when we fire off all the constraints.
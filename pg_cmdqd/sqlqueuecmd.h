@@ -1,11 +1,13 @@
 #ifndef SQLQUEUECMD_H
 #define SQLQUEUECMD_H
 
+#include <chrono>
 #include <string>
 
 #include "pq-raii/libpq-raii.hpp"
 #include "cmdqueue.h"
 #include "logger.h"
+#include "preparedstatementcache.h"
 #include "queuecmdmetadata.h"
 
 
@@ -22,27 +24,85 @@ class SqlQueueCmd
             const PG::result &result);
 
 public:
+    /**
+     * State that outlives a single command and is kept by the `CmdQueueRunner` between commands.
+     */
+    struct RunnerState
+    {
+        /**
+         * The `cmd_sql` statements with `cmd_sql_params` that have been prepared on the runner's connection.
+         */
+        PreparedStatementCache prepared_cmd_sql;
+
+        /**
+         * Reused to bind the `cmd_sql_params` of every command.
+         */
+        PG::params cmd_sql_params;
+
+        /**
+         * The read end of the runner's kill pipe, which, when readable, makes us cancel a running `cmd_sql`.
+         */
+        int kill_fd = -1;
+    };
+
     QueueCmdMetadata meta;
 
     std::string cmd_sql;
+
+    /**
+     * The values for the `$1`, `$2`, etc. placeholders in `cmd_sql`, if `cmd_sql_params` is not `NULL`.
+     */
+    std::optional<std::vector<std::optional<std::string>>> cmd_sql_params;
     std::string cmd_sql_result_status;
-    std::vector<std::vector<std::string>> cmd_sql_result_rows;
+
+    /**
+     * The rows returned by `cmd_sql`, as a JSON array of objects; see `JsonRowsEncoder`.  None if `cmd_sql`
+     * returned no result set (or failed).
+     */
+    std::optional<std::string> cmd_sql_result_rows;
+
     std::optional<std::map<char, std::optional<std::string>>> cmd_sql_fatal_error;
     std::vector<std::map<char, std::optional<std::string>>> cmd_sql_nonfatal_errors;
 
+    /**
+     * The columns of a `sql_queue_cmd` `SELECT` result, following those of the `QueueCmdMetadata`.
+     */
+    enum Column
+    {
+        CMD_SQL = QueueCmdMetadata::COLUMNS.size(),
+        CMD_SQL_PARAMS,
+    };
+    static constexpr PG::column_names<QueueCmdMetadata::COLUMNS.size() + 2> COLUMNS
+        = PG::concat_column_names(QueueCmdMetadata::COLUMNS, PG::column_names<2>{
+            "cmd_sql",
+            "cmd_sql_params",
+        });
+    typedef PG::column_numbers<COLUMNS.size()> ColumnNumbers;
+
     SqlQueueCmd() = delete;
-    SqlQueueCmd(const PG::result &result,
-                int row,
-                const std::unordered_map<std::string, int> &fieldMapping) noexcept;
+    SqlQueueCmd(const PG::row &row, const ColumnNumbers &columns) noexcept;
     ~SqlQueueCmd() = default;
 
     bool is_valid() const;
 
-    std::vector<std::optional<std::string>> update_params() const;
-    std::vector<int> update_param_lengths() const;
-    std::vector<int> update_param_formats() const;
+    /**
+     * Bind the parameters of the prepared `update_cmd` statement, mostly by reference; see `PG::params`.
+     */
+    void bind_update_params(PG::params &params) const;
+
+    void run_cmd(std::shared_ptr<PG::conn> &conn, const CmdQueue &cmd_queue, RunnerState &runner_state);
+
+private:
+    /**
+     * `"CMDQD_TIMEOUT"` or `"CMDQD_CANCELED"`, once we've tried to cancel the running `cmd_sql`.
+     */
+    std::optional<std::string> _cancel_status;
 
-    void run_cmd(std::shared_ptr<PG::conn> &conn, const double queue_cmd_timeout_sec);
+    bool wait_for_input(std::shared_ptr<PG::conn> &conn,
+                        const std::optional<std::chrono::steady_clock::time_point> &deadline,
+                        int kill_fd);
+    bool send_cmd_sql(std::shared_ptr<PG::conn> &conn, RunnerState &runner_state);
+    void exec_cmd_sql(std::shared_ptr<PG::conn> &conn, const CmdQueue &cmd_queue, RunnerState &runner_state);
 };
 
 #endif // SQLQUEUECMD_H
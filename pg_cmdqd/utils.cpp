@@ -49,3 +49,13 @@ std::unordered_map<std::string, std::string> environ_to_unordered_map(char **env
 
     return map;
 }
+
+std::vector<char *> c_str_array(const std::vector<std::string> &strings)
+{
+    std::vector<char *> ptrs;
+    ptrs.reserve(strings.size() + 1);
+    for (const std::string &s : strings)
+        ptrs.push_back(const_cast<char *>(s.c_str()));
+    ptrs.push_back(nullptr);
+    return ptrs;
+}
@@ -4,8 +4,11 @@
 #include <string.h>
 #include <errno.h>
 
+#include <optional>
+#include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 template<typename T> int check(int rc)
 {
@@ -25,17 +28,24 @@ int maskAllSignalsCurrentThread();
 
 std::unordered_map<std::string, std::string> environ_to_unordered_map(char **environ);
 
+/**
+ * A `nullptr`-terminated array of pointers into `strings`, fit for `exec*()`.  Only valid for as long as
+ * `strings` is left alone.
+ */
+std::vector<char *> c_str_array(const std::vector<std::string> &strings);
+
 template<typename K, typename V> std::unordered_map<K, V>
-inline throw_if_missing_any_value(const std::unordered_map<K, std::optional<V>> &map)
+inline throw_if_missing_any_value(std::unordered_map<K, std::optional<V>> map)
 {
-    // TODO: This is super ugly. Maybe Wiebe has ideas to only do the checking and make
-    //       this non-optional without copying everything.
-    std::unordered_map<std::string, std::string> nonoptional_map;
-    for (auto pair : map)
+    // The values are moved rather than copied; only the keys have to be copied, since we can't move them out
+    // of the map.
+    std::unordered_map<K, V> nonoptional_map;
+    nonoptional_map.reserve(map.size());
+    for (auto &pair : map)
     {
         if (not pair.second)
             throw std::runtime_error("Unexpected key without value.");
-        nonoptional_map[pair.first] = pair.second.value();
+        nonoptional_map.emplace(pair.first, std::move(pair.second.value()));
     }
     return nonoptional_map;
 }
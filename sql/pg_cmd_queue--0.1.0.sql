@@ -373,6 +373,15 @@ variables:
 | Setting name                          | Default setting  |
 | ------------------------------------- | ---------------- |
 | `pg_cmd_queue.notify_channel`         | `cmdq`           |
+| `pg_cmd_queue.coalesce_notify`        | `off`            |
+
+With `pg_cmd_queue.coalesce_notify` set to `on` (best with `SET LOCAL`), the
+[`queue_cmd__notify()`](#function-queue_cmd__notify) trigger function leaves
+out the `cmd_id` and `cmd_subid` from the `NOTIFY` payload of `INSERT`ed
+commands, so that a bulk `INSERT` or `COPY` results in one notification per
+queue per transaction, after which `pg_cmdqd` keeps `SELECT`ing commands until
+the queue is empty.  The notifications for `UPDATE`s and `DELETE`s are not
+coalesced.
 
 ## Planned features for `pg_cmd_queue`
 
@@ -676,6 +685,69 @@ create table cmd_queue (
     ,queue_select_timeout interval
         default '10 seconds'::interval
     ,queue_cmd_timeout interval
+    ,queue_worker_argv text[]
+        check (queue_worker_argv is null or array_length(queue_worker_argv, 1) >= 1)
+    ,queue_worker_max_cmds int
+        check (queue_worker_max_cmds is null or queue_worker_max_cmds > 0)
+    ,queue_output_codec text
+        check (queue_output_codec in ('lz4'))
+    ,queue_max_stdout_bytes bigint
+        check (queue_max_stdout_bytes is null or queue_max_stdout_bytes > 0)
+    ,queue_max_stderr_bytes bigint
+        check (queue_max_stderr_bytes is null or queue_max_stderr_bytes > 0)
+    ,queue_output_capture text
+        not null
+        default 'pipe'
+        check (queue_output_capture in ('pipe', 'memfd'))
+    ,queue_output_spill_dir text
+        check (queue_output_spill_dir like '/%')
+    ,queue_output_spill_threshold_bytes bigint
+        not null
+        default 1048576
+        check (queue_output_spill_threshold_bytes >= 0)
+    ,queue_rlimit_as_bytes bigint
+        check (queue_rlimit_as_bytes is null or queue_rlimit_as_bytes > 0)
+    ,queue_rlimit_cpu interval
+        check (queue_rlimit_cpu is null or queue_rlimit_cpu >= '1 second'::interval)
+    ,queue_rlimit_nofile int
+        check (queue_rlimit_nofile is null or queue_rlimit_nofile > 0)
+    ,queue_cmd_nice int
+        check (queue_cmd_nice between -20 and 19)
+    ,queue_cmd_ioprio_class text
+        check (queue_cmd_ioprio_class in ('realtime', 'best-effort', 'idle'))
+    ,queue_cmd_ioprio_level int
+        check (queue_cmd_ioprio_level between 0 and 7)
+    ,queue_cpu_set int[]
+        check (
+            queue_cpu_set is null
+            or (
+                array_length(queue_cpu_set, 1) >= 1
+                and array_position(queue_cpu_set, null) is null
+                and 0 <= all (queue_cpu_set)
+            )
+        )
+    ,queue_sched_policy text
+        check (queue_sched_policy in ('batch', 'idle'))
+    ,queue_max_result_rows bigint
+        check (queue_max_result_rows is null or queue_max_result_rows >= 0)
+    ,queue_max_result_bytes bigint
+        check (queue_max_result_bytes is null or queue_max_result_bytes >= 2)
+    ,queue_cmd_sql_cache_size int
+        not null
+        default 32
+        check (queue_cmd_sql_cache_size >= 0)
+    ,queue_group_commit_max_cmds int
+        not null
+        default 1
+        check (queue_group_commit_max_cmds >= 1)
+    ,queue_group_commit_max_latency interval
+        not null
+        default '50 milliseconds'::interval
+        check (queue_group_commit_max_latency >= '0'::interval)
+    ,queue_parallel_cmds int
+        not null
+        default 1
+        check (queue_parallel_cmds >= 1)
     /*
     ,queue_update_retries_allowed int
         not null
@@ -715,6 +787,353 @@ $md$;
 
 comment on column cmd_queue.queue_runner_role is
 $md$This is the role as which the queue runner should select from the queue and run update commands.
+
+The runner switches its session to this role with `SET SESSION ROLE`, so the
+role `pg_cmdqd` connects as must be a member of it.
+
+**`queue_runner_role` is _not_ a security boundary for `sql_queue_cmd` queues.**
+The `cmd_sql` of a command runs in the runner's session, where it can simply
+`RESET ROLE` (or `SET ROLE` to any other role that the login role is a member
+of) and continue with all the privileges of the role that `pg_cmdqd` logged in
+as.  To really confine the `cmd_sql` of a queue to fewer privileges, run a
+separate `pg_cmdqd` for that queue, which logs in as a role that has no more
+privileges than the commands should have.  For `nix_queue_cmd` queues, the
+role does limit what the runner itself selects and updates, because their
+commands don't run inside the runner's session.
+
+The `queue_runner_role` needs:
+
+- `USAGE` on the `cmdq` and `cmdqd` schemas, and on the schema of the
+  `cmd_class`;
+- `SELECT` and `UPDATE` on the `cmd_class` relation (`UPDATE` also because the
+  runner selects with `FOR UPDATE`);
+- `EXECUTE` on the `cmdqd` functions and procedures that prepare and run the
+  select and update statements (`cmdqd.prepare_to_select_cmd_from_queue()`,
+  `cmdqd.select_cmd_from_queue_stmt()`, `cmdqd.prepare_to_update_cmd_in_queue()`,
+  `cmdqd.update_cmd_in_queue_stmt()`, `cmdqd.update_cmd_in_queue_param_types()`,
+  `cmdqd.enter_reselect_round()` and
+  `cmdqd.remember_failed_update_for_this_reselect_round()`), and on
+  `cmdq.pg_cmd_queue_notify_channel()`—which it has through `PUBLIC`, unless
+  that has been revoked;
+- `TEMPORARY` on the database, for the session's `updated_cmd` table and its
+  `pg_cmdqd_env()` function.
+
+`LISTEN`ing on the `queue_notify_channel` and `NOTIFY`ing the
+`pg_cmd_queue.notify_channel` take no privileges: in Postgres, any role can
+listen on or notify any channel.
+$md$;
+
+comment on column cmd_queue.queue_cmd_timeout is
+$md$How long a single command may run before `pg_cmdqd` stops it; `NULL` (the default) for no limit.
+
+A `nix_queue_cmd` that exceeds its timeout is sent a `SIGTERM`, followed by a
+`SIGKILL` if it is still running a second later.  The `cmd_sql` of a
+`sql_queue_cmd` that exceeds its timeout is canceled, after which its
+`cmd_sql_result_status` becomes `CMDQD_TIMEOUT`.
+$md$;
+
+comment on column cmd_queue.queue_worker_argv is
+$md$The `argv` with which `pg_cmdqd` starts a long-lived worker process for a `nix_queue_cmd` queue.
+
+When this column is `NULL` (the default), every command is `fork()`ed and
+`exec()`ed by itself.  When it is set, each command of which the `cmd_argv`
+starts with the elements of `queue_worker_argv` is instead handed to a worker
+process that has been started with exactly `queue_worker_argv`.  Commands of
+which the `cmd_argv` does not start with this prefix are still run the normal
+way.  This makes sense for commands with an expensive startup, like scripts that
+need several seconds to import their libraries.
+
+The runner and its worker talk to each other over the worker's STDIN and
+STDOUT.  Every message is framed as a 4-byte big-endian length, followed by
+that many bytes of payload.  Within the payload, every string is again prefixed
+by its 4-byte big-endian length, and every count is also 4 bytes, big-endian.
+
+The request payload consists of:
+
+1. the number of remaining arguments, followed by these arguments (that is,
+   the `cmd_argv` _without_ the `queue_worker_argv` prefix);
+2. the number of `cmd_env` variables, followed by, for every variable, its
+   name and its value; and
+3. the `cmd_stdin`.
+
+The reply payload that the worker must write back consists of:
+
+1. the exit code, as a 4-byte big-endian signed integer;
+2. the `cmd_stdout`; and
+3. the `cmd_stderr`.
+
+The worker's own STDERR is inherited from `pg_cmdqd`.  When the worker dies
+before it replies in full, the command gets the worker's exit code or
+termination signal and the worker is restarted for the next command.  When
+`queue_cmd_timeout` is exceeded, the worker is stopped with `SIGTERM` (and, if
+needed, `SIGKILL`), exactly as an ordinary command would be.
+$md$;
+
+comment on column cmd_queue.queue_worker_max_cmds is
+$md$After how many commands the worker process started from `queue_worker_argv` is to be replaced.
+
+When `NULL`, the worker is only replaced if it dies.  The runner retires a
+worker by closing the worker's STDIN, on which the worker is expected to exit.
+$md$;
+
+comment on column cmd_queue.queue_output_codec is
+$md$The codec with which `pg_cmdqd` compresses the `cmd_stdout` and `cmd_stderr` of a `nix_queue_cmd` before writing them back to the queue.
+
+When this column is `NULL` (the default), the output is written back as-is.
+The only codec that is currently supported is `'lz4'`, which stores every
+output in the [LZ4 frame
+format](https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md); such
+output can be decompressed with the `lz4` command-line utility, or, from SQL,
+with the `lz4_frame_decompress()` function.  Use `cmd_output_decoded()` to read
+the output of any queue, regardless of its `queue_output_codec`.
+
+Mind that Postgres by itself already compresses large `bytea` values with
+`pglz` or (with `default_toast_compression = 'lz4'`) with `lz4`, but only once
+they're bigger than about 2 kB and only _after_ they have been sent from
+`pg_cmdqd` to the server.  Compressing in `pg_cmdqd` saves on network traffic
+and WAL volume for very verbose commands, at the expense of having to decode
+the output before it can be read.
+
+Changing the codec of a queue does _not_ recompress the output of commands that
+already ran.
+$md$;
+
+comment on column cmd_queue.queue_max_stdout_bytes is
+$md$How many bytes of the STDOUT of each `nix_queue_cmd` `pg_cmdqd` should keep, at most.
+
+When this column is `NULL` (the default), `cmd_stdout` holds everything that
+the command wrote to its STDOUT.  When the command writes more than
+`queue_max_stdout_bytes`, `pg_cmdqd` keeps only the first and the last half of
+that many bytes, with a marker like `[… 12345 bytes truncated by pg_cmdqd …]`
+on a line of its own in between.  The command's STDOUT is read until the end
+regardless, so that the command never blocks on a full pipe.
+
+This protects `pg_cmdqd` (and the queue table) against runaway commands that
+would otherwise make it run out of memory or exceed the 1 GB limit of a `bytea`
+value.  The limit applies _before_ any `queue_output_codec` compression.
+
+To know how many bytes a command wrote in total, a queue can add an extra
+`cmd_stdout_bytes bigint` column after the `nix_queue_cmd_template` columns.
+Like `cmd_rusage`, this column is set by `pg_cmdqd` if it exists.
+$md$;
+
+comment on column cmd_queue.queue_max_stderr_bytes is
+$md$How many bytes of the STDERR of each `nix_queue_cmd` `pg_cmdqd` should keep, at most.
+
+This works the same as `queue_max_stdout_bytes`, with `cmd_stderr` instead of
+`cmd_stdout` and the optional `cmd_stderr_bytes bigint` column instead of
+`cmd_stdout_bytes`.  Only the STDERR lines that end up in the head are logged
+while the command is running.
+$md$;
+
+comment on column cmd_queue.queue_output_capture is
+$md$How `pg_cmdqd` captures the STDOUT and STDERR of each `nix_queue_cmd`: through `'pipe'`s (the default) or in `'memfd'`s.
+
+With `'pipe'`, `pg_cmdqd` reads the output while the command is running, and
+logs every STDERR line as soon as it comes in.
+
+With `'memfd'`, the command writes its output to anonymous, memory-backed files
+(see [`memfd_create(2)`](https://man7.org/linux/man-pages/man2/memfd_create.2.html)),
+which `pg_cmdqd` leaves alone until the command has exited.  The STDOUT is then
+`mmap()`ed and sent to Postgres from there, without first being copied.  This
+suits batch-style jobs with a lot of output, but it means that:
+
+* STDERR is only logged after the command has exited;
+* the output is kept in memory (by the kernel) in full while the command runs,
+  because `queue_max_stdout_bytes` and `queue_max_stderr_bytes` can only be
+  applied afterwards; and
+* it only works on Linux.
+
+Commands that are handed to a worker process (see `queue_worker_argv`) are not
+affected by this setting.
+$md$;
+
+comment on column cmd_queue.queue_output_spill_dir is
+$md$The directory (on the host of `pg_cmdqd`) to which `pg_cmdqd` moves command output that is bigger than `queue_output_spill_threshold_bytes`, instead of storing it in the queue.
+
+Spilled output is stored by its SHA-256 hash, in a
+`<queue_output_spill_dir>/<first 2 hex digits>/<hash>` file, so that identical
+output is stored only once.  The `cmd_stdout` or `cmd_stderr` of the command is
+then left empty, and its hash, size and path are stored in the
+`cmd_stdout_blob` or `cmd_stderr_blob` column, of type `cmd_output_blob`.
+These columns are optional extra columns after the `nix_queue_cmd_template`
+columns, but this setting is ignored unless the queue relation has both.
+
+This keeps queue tables small and cheap to vacuum, while big reports are still
+retained.  Output is only spilled after `queue_max_stdout_bytes` and
+`queue_max_stderr_bytes` have been applied, and spilled output is never
+compressed with the `queue_output_codec`.  When the output cannot be spilled
+(because the directory doesn't exist, for instance), it is stored in the queue
+after all.
+
+`pg_cmdqd` never deletes spilled files; that is up to whoever deletes the
+commands that refer to them.
+$md$;
+
+comment on column cmd_queue.queue_output_spill_threshold_bytes is
+$md$Above how many bytes the `cmd_stdout` or `cmd_stderr` of a command is moved to the `queue_output_spill_dir`.
+$md$;
+
+comment on column cmd_queue.queue_rlimit_as_bytes is
+$md$The maximum size of the virtual memory (`RLIMIT_AS`) of every process that `pg_cmdqd` starts for a `nix_queue_cmd` queue.
+
+This, and the other `queue_rlimit_*`, `queue_cmd_nice` and `queue_cmd_ioprio_*`
+settings, are applied with
+[`setrlimit(2)`](https://man7.org/linux/man-pages/man2/setrlimit.2.html),
+[`setpriority(2)`](https://man7.org/linux/man-pages/man2/setpriority.2.html) and
+[`ioprio_set(2)`](https://man7.org/linux/man-pages/man2/ioprio_set.2.html)
+between `fork()` and `exec()`, so that the queues that share a host can be kept
+from starving each other.  A `NULL` setting (the default) leaves the value that
+the command inherits from `pg_cmdqd` alone.  When a setting cannot be applied
+(because `pg_cmdqd` lacks the privileges to lower the `queue_cmd_nice`, for
+instance), the command is not run and exits with code 128, with the error in its
+`cmd_stderr`.
+
+For commands that are handed to a worker process (see `queue_worker_argv`), the
+limits apply to the worker as a whole.
+
+A command that runs into its `RLIMIT_AS` is not killed; its memory allocations
+simply start to fail, and how it deals with that is up to the command.
+$md$;
+
+comment on column cmd_queue.queue_rlimit_cpu is
+$md$How much CPU time (`RLIMIT_CPU`, in whole seconds) every process that `pg_cmdqd` starts for a `nix_queue_cmd` queue may use.
+
+The kernel sends a process that exceeds this limit a `SIGXCPU`, and `SIGKILL`s it
+a second later if it is still running.  Either way, `pg_cmdqd` sets the
+`cmd_term_sig` of the command to `SIGXCPU` (24 on Linux), so that commands that
+were stopped for using too much CPU can be told apart from commands that were
+killed for taking too long in wall-clock time (see `queue_cmd_timeout`).
+
+For a worker process (see `queue_worker_argv`), this limit counts the CPU time
+of all the commands that the worker ran; combine it with
+`queue_worker_max_cmds`.
+$md$;
+
+comment on column cmd_queue.queue_rlimit_nofile is
+$md$How many files (`RLIMIT_NOFILE`) every process that `pg_cmdqd` starts for a `nix_queue_cmd` queue may have open at once.
+$md$;
+
+comment on column cmd_queue.queue_cmd_nice is
+$md$The nice value, from -20 (the highest CPU priority) to 19 (the lowest), of every process that `pg_cmdqd` starts for a `nix_queue_cmd` queue.
+
+Only a privileged `pg_cmdqd` can set a nice value below its own.
+$md$;
+
+comment on column cmd_queue.queue_cmd_ioprio_class is
+$md$The I/O scheduling class—`'realtime'`, `'best-effort'` or `'idle'`—of every process that `pg_cmdqd` starts for a `nix_queue_cmd` queue.
+
+`'idle'` suits batch jobs which should only get disk time when no other process
+needs it.  Only a privileged `pg_cmdqd` can use the `'realtime'` class.  This
+setting is Linux-only, and only has effect with an I/O scheduler that supports
+priorities, like BFQ.
+$md$;
+
+comment on column cmd_queue.queue_cmd_ioprio_level is
+$md$The priority, from 0 (the highest) to 7 (the lowest), within the `queue_cmd_ioprio_class`; 4 if `NULL`.
+
+This setting is ignored when `queue_cmd_ioprio_class` is `NULL` or `'idle'`.
+$md$;
+
+comment on column cmd_queue.queue_cpu_set is
+$md$The numbers of the CPUs (counting from 0) to which `pg_cmdqd` confines the runner thread of this queue, and therefore every process that the runner starts.
+
+Together with `queue_sched_policy`, this keeps bulk queues from stealing cycles
+from latency-sensitive queues: give the latter a few dedicated CPUs and confine
+the former to the rest.  When this column is `NULL` (the default), the runner
+runs on whichever CPUs `pg_cmdqd` itself may run on.  CPUs that `pg_cmdqd` is
+not allowed to use are ignored; when _none_ of the CPUs can be used, the error
+is logged and the runner is left unconfined.
+
+Unlike the `queue_rlimit_*` settings, this setting also applies to
+`sql_queue_cmd` queues, but only to the runner thread, not to the Postgres
+backend that does the actual work.
+$md$;
+
+comment on column cmd_queue.queue_sched_policy is
+$md$The Linux scheduling policy of the runner thread of this queue, and of every process that the runner starts: `'batch'` (`SCHED_BATCH`), `'idle'` (`SCHED_IDLE`), or, when `NULL`, the policy of `pg_cmdqd` itself.
+
+`'batch'` tells the kernel that the processes are CPU-bound and not
+interactive, so that they are preempted less often and yield to interactive
+processes more readily.  `'idle'` processes only get the CPU time that nothing
+else wants.  See [`sched(7)`](https://man7.org/linux/man-pages/man7/sched.7.html).
+$md$;
+
+comment on column cmd_queue.queue_max_result_rows is
+$md$How many of the rows returned by the `cmd_sql` of each `sql_queue_cmd` `pg_cmdqd` keeps in `cmd_sql_result_rows`, at most.
+
+`pg_cmdqd` fetches the result of `cmd_sql` row by row (or, with libpq 17 or
+newer, in chunks of rows), and encodes every row to JSON as soon as it comes
+in, so that even a huge result never has to be held in memory as a whole.  Rows
+beyond `queue_max_result_rows` (or beyond `queue_max_result_bytes`) are still
+fetched, but are then thrown away; this is logged as a warning.  When `NULL`
+(the default), there is no limit.
+$md$;
+
+comment on column cmd_queue.queue_max_result_bytes is
+$md$How many bytes the JSON in `cmd_sql_result_rows` may be, at most.
+
+This works like `queue_max_result_rows`, with the exception that the limit is
+in bytes of JSON text rather than in rows.  The first row that doesn't fit, and
+every row after it, are left out, so that `cmd_sql_result_rows` always holds the
+first rows of the result, without gaps.
+$md$;
+
+comment on column cmd_queue.queue_cmd_sql_cache_size is
+$md$How many distinct `cmd_sql` statements with `cmd_sql_params` `pg_cmdqd` keeps `PREPARE`d per connection.
+
+When a command comes along with a `cmd_sql` that is not yet prepared while the
+cache is full, the least recently used statement is `DEALLOCATE`d.  With `0`,
+statements with `cmd_sql_params` are still executed with their parameters, but
+they are parsed and planned anew for every command.
+$md$;
+
+comment on column cmd_queue.queue_group_commit_max_cmds is
+$md$How many `sql_queue_cmd`s `pg_cmdqd` may run and write back in a single transaction.
+
+With the default of `1`, every command gets its own transaction, and thus its
+own `COMMIT`.  For tiny SQL commands, waiting for the WAL to be flushed on every
+`COMMIT` easily takes longer than running the commands themselves.  With a
+higher number, after running a command, `pg_cmdqd` picks the next command from
+the queue in the same transaction, until it has run `queue_group_commit_max_cmds`
+commands, until the queue is empty, or until `queue_group_commit_max_latency`
+has passed since the start of the group.  Only then does it `COMMIT`.
+
+Every command in a group is run within its own savepoint, so that a command
+that fails is still isolated from the other commands in the group.  So is the
+`SELECT` of each next command: if it fails, the commands that have already run
+are committed, before `pg_cmdqd` waits for the next reselect round.  But, until
+the group is committed, the results of all its commands stay invisible to other
+sessions, and the rows of all the commands in the group stay locked.
+
+This setting is ignored for `nix_queue_cmd` queues, because their commands have
+side effects outside the database, which would remain when the group is rolled
+back.
+$md$;
+
+comment on column cmd_queue.queue_group_commit_max_latency is
+$md$For how long, at most, `pg_cmdqd` keeps adding commands to a group; see `queue_group_commit_max_cmds`.
+
+A group is never cut short in the middle of a command, so a slow command can
+still make the group take longer than this.
+$md$;
+
+comment on column cmd_queue.queue_parallel_cmds is
+$md$How many `sql_queue_cmd`s `pg_cmdqd` may run at the same time.
+
+By default, the runner of a SQL queue runs one command at a time, over a single
+connection.  With `queue_parallel_cmds` set to _n_, the runner opens _n_
+connections, each of which picks commands from the queue on its own.  Because
+commands are selected with `FOR UPDATE SKIP LOCKED`, no two connections ever
+pick the same command.  Every command runs on the connection that holds the
+lock on its row, and its result is written back over that same connection.
+
+Commands in the same queue that are run in parallel must not depend on each
+other's results, and they should not contend for the same locks, or they will
+still end up waiting for each other.  Mind that every connection counts towards
+the server's `max_connections`.
+
+This setting is ignored for `nix_queue_cmd` queues.
 $md$;
 
 select pg_catalog.pg_extension_config_dump('cmd_queue', 'WHERE pg_extension_name IS NULL');
@@ -1229,6 +1648,13 @@ begin
         end;
     end if;
 
+    if tg_op = 'INSERT' and nullif(current_setting('pg_cmd_queue.coalesce_notify', true), '')::bool then
+        -- Postgres delivers identical notifications from the same transaction only once.  `UPDATE`s and
+        -- `DELETE`s still get their `cmd_id` and `cmd_subid` in the payload.
+        perform pg_notify(_queue_notify_channel, row(_cmd_class_qualified, null::text, null::text)::text);
+        return null;
+    end if;
+
     if tg_op = 'INSERT' then
         execute 'SELECT ' || _cmd_id_expression using NEW into _cmd_id;
         execute 'SELECT ' || _cmd_subid_expression using NEW into _cmd_subid;
@@ -1285,6 +1711,11 @@ parameter is accepted, because the signature for
 3. The third argument (`cmd_id_source`) defaults to `'cmd_id'`, which is
    probably what you want
 
+When the [`pg_cmd_queue.coalesce_notify`](#pg_cmd_queue-settings) setting is
+`on`, the `cmd_id` and `cmd_subid` of `INSERT`ed commands are left `NULL` in
+the payload, which Postgres then delivers only once per transaction.  For
+`UPDATE`s and `DELETE`s, the setting makes no difference.  This is what the
+`pg_cmdq_enqueue` bulk producer does for every batch that it `COPY`s.
 $md$;
 
 --------------------------------------------------------------------------------------------------------------
@@ -1318,11 +1749,37 @@ create function nix_queue_cmd__require_exit_success()
     set search_path from current
     language plpgsql
     as $$
+declare
+    _stdout_blob cmd_output_blob;
+    _stderr_blob cmd_output_blob;
+    _detail text;
 begin
     assert tg_when in ('BEFORE', 'AFTER');
     assert tg_op = 'UPDATE';
     assert tg_level = 'ROW';
 
+    if NEW.cmd_exit_code > 0 or NEW.cmd_term_sig is not null then
+        -- The optional `cmd_std(out|err)_blob` columns are accessed via `hstore`, because the queue may not
+        -- have them.
+        _stdout_blob := (hstore(NEW) -> 'cmd_stdout_blob')::cmd_output_blob;
+        _stderr_blob := (hstore(NEW) -> 'cmd_stderr_blob')::cmd_output_blob;
+
+        -- Spilled output is only referred to; reading it back could make for a huge error message.
+        _detail := 'cmd_line: ' || cmd_line(NEW.cmd_argv, NEW.cmd_env)
+            || coalesce(
+                E'\ncmd_stderr: [' || _stderr_blob.size_bytes || ' bytes in ' || _stderr_blob.path || ']'
+                ,E'\ncmd_stderr: '
+                    || convert_from(nullif(cmd_output_decoded(NEW.cmd_stderr, OLD.cmd_class), ''::bytea), 'UTF-8')
+                ,''
+            )
+            || coalesce(
+                E'\ncmd_stdout: [' || _stdout_blob.size_bytes || ' bytes in ' || _stdout_blob.path || ']'
+                ,E'\ncmd_stdout: '
+                    || convert_from(nullif(cmd_output_decoded(NEW.cmd_stdout, OLD.cmd_class), ''::bytea), 'UTF-8')
+                ,''
+            );
+    end if;
+
     if NEW.cmd_exit_code > 0 then
         raise exception using
             errcode = 'PE' || right('000' || NEW.cmd_exit_code::text,  3)
@@ -1332,11 +1789,7 @@ begin
                 ,OLD.cmd_id
                 ,OLD.cmd_class
             )
-            ,detail = (
-                'cmd_line: ' || cmd_line(NEW.cmd_argv, NEW.cmd_env)
-                || coalesce(E'\ncmd_stderr: ' || convert_from(nullif(NEW.cmd_stderr, ''::bytea), 'UTF-8'),  '')
-                || coalesce(E'\ncmd_stdout: ' || convert_from(nullif(NEW.cmd_stdout, ''::bytea), 'UTF-8'),  '')
-            )
+            ,detail = _detail
             ,schema = tg_table_schema
             ,table = tg_table_name
             ,column = 'cmd_exit_code'
@@ -1352,11 +1805,7 @@ begin
                 ,OLD.cmd_id
                 ,OLD.cmd_class
             )
-            ,detail = format(
-                'cmd_line: ' || cmd_line(NEW.cmd_argv, NEW.cmd_env)
-                || coalesce(E'\ncmd_stderr: ' || convert_from(nullif(NEW.cmd_stderr, ''::bytea), 'UTF-8'),  '')
-                || coalesce(E'\ncmd_stdout: ' || convert_from(nullif(NEW.cmd_stdout, ''::bytea), 'UTF-8'),  '')
-            )
+            ,detail = _detail
             ,schema = tg_table_schema
             ,table = tg_table_name
             ,column = 'cmd_term_sig'
@@ -1501,6 +1950,101 @@ create trigger no_insert
 
 --------------------------------------------------------------------------------------------------------------
 
+create type nix_cmd_rusage as (
+    ru_utime interval
+    ,ru_stime interval
+    ,ru_maxrss_kib bigint
+    ,ru_inblock bigint
+    ,ru_oublock bigint
+    ,ru_nvcsw bigint
+    ,ru_nivcsw bigint
+);
+
+comment on type nix_cmd_rusage is
+$md$The resource usage of a `nix_queue_cmd`, as reported by `wait4()` when `pg_cmdqd` reaps the command.
+
+A `nix_queue_cmd` queue can opt into receiving this by adding an extra
+`cmd_rusage nix_cmd_rusage` column after the `nix_queue_cmd_template` columns.
+If the queue relation has such a column, `pg_cmdqd` will set it in the same
+`UPDATE` that sets `cmd_exit_code`, `cmd_term_sig`, `cmd_stdout` and
+`cmd_stderr`.
+
+The fields mirror those of the same name in `struct rusage`; see
+[`getrusage(2)`](https://man7.org/linux/man-pages/man2/getrusage.2.html):
+
+* `ru_utime` and `ru_stime` are the user and system CPU time;
+* `ru_maxrss_kib` is the maximum resident set size, in kibibytes;
+* `ru_inblock` and `ru_oublock` are the number of block input and output
+  operations; and
+* `ru_nvcsw` and `ru_nivcsw` are the number of voluntary and involuntary
+  context switches.
+
+Commands that are handed to a worker process (see
+`cmd_queue.queue_worker_argv`) are not reaped one by one, and thus leave
+`cmd_rusage` `NULL`.
+$md$;
+
+--------------------------------------------------------------------------------------------------------------
+
+create type cmd_output_blob as (
+    sha256 bytea
+    ,size_bytes bigint
+    ,path text
+);
+
+comment on type cmd_output_blob is
+$md$A reference to command output that `pg_cmdqd` has spilled to a file in the `cmd_queue.queue_output_spill_dir`, rather than storing it in the `cmd_stdout` or `cmd_stderr` column.
+
+Use `cmd_output_blob_read()` to read it back.
+$md$;
+
+--------------------------------------------------------------------------------------------------------------
+
+create function cmd_output_blob_read(cmd_output_blob)
+    returns bytea
+    set search_path from current
+    language plpgsql
+    as $$
+declare
+    _content bytea;
+begin
+    if $1 is null then
+        return null;
+    end if;
+
+    _content := pg_catalog.pg_read_binary_file(($1).path);
+
+    if length(_content) != ($1).size_bytes or sha256(_content) != ($1).sha256 then
+        raise data_corrupted using
+            message = format('The content of `%s` does not match its `cmd_output_blob`.', ($1).path)
+            ,detail = format(
+                'Expected %s bytes with SHA-256 %s; found %s bytes with SHA-256 %s.'
+                ,($1).size_bytes
+                ,encode(($1).sha256, 'hex')
+                ,length(_content)
+                ,encode(sha256(_content), 'hex')
+            );
+    end if;
+
+    return _content;
+end;
+$$;
+
+comment on function cmd_output_blob_read(cmd_output_blob) is
+$md$Read back command output that `pg_cmdqd` spilled to a file in the `cmd_queue.queue_output_spill_dir`.
+
+The file is read with `pg_read_binary_file()`, and thus has to be accessible
+to the Postgres server at the same path as to `pg_cmdqd`—either because they run
+on the same host, or because the directory is mounted at the same path on both
+hosts.  The role calling this function must be allowed to read server files,
+for example, through membership of the `pg_read_server_files` role.
+
+The size and SHA-256 hash of the file are checked against those recorded in the
+`cmd_output_blob`.
+$md$;
+
+--------------------------------------------------------------------------------------------------------------
+
 create function nix_queue_cmd_template(record)
     returns nix_queue_cmd_template
     immutable
@@ -1690,6 +2234,233 @@ $$;
 
 --------------------------------------------------------------------------------------------------------------
 
+create function lz4_frame_decompress(lz4_frame$ bytea)
+    returns bytea
+    immutable
+    parallel safe
+    language plpgsql
+    as $$
+declare
+    _len constant int := length(lz4_frame$);
+    _pos int := 0;  -- 0-based, like `get_byte()`
+    _magic bigint;
+    _flg int;
+    _block_size bigint;
+    _block_end int;
+    _token int;
+    _literal_len int;
+    _match_len int;
+    _match_offset int;
+    _len_byte int;
+    _out int[] := array[]::int[];  -- Assigning to array elements in PL/pgSQL doesn't copy the array.
+    _out_len int := 0;
+    _i int;
+begin
+    while _pos < _len loop
+        _magic := get_byte(lz4_frame$, _pos)::bigint
+            | get_byte(lz4_frame$, _pos + 1)::bigint << 8
+            | get_byte(lz4_frame$, _pos + 2)::bigint << 16
+            | get_byte(lz4_frame$, _pos + 3)::bigint << 24;
+        _pos := _pos + 4;
+
+        if _magic between x'184D2A50'::bigint and x'184D2A5F'::bigint then
+            -- Skippable frame
+            _pos := _pos + 4 + (
+                get_byte(lz4_frame$, _pos)::bigint
+                | get_byte(lz4_frame$, _pos + 1)::bigint << 8
+                | get_byte(lz4_frame$, _pos + 2)::bigint << 16
+                | get_byte(lz4_frame$, _pos + 3)::bigint << 24
+            );
+            continue;
+        end if;
+
+        if _magic != x'184D2204'::bigint then
+            raise exception 'Not an LZ4 frame: unexpected magic number 0x% at byte %.', to_hex(_magic), _pos - 4;
+        end if;
+
+        _flg := get_byte(lz4_frame$, _pos);
+        if _flg >> 6 != 1 then
+            raise exception 'Unsupported LZ4 frame version: %.', _flg >> 6;
+        end if;
+        if _flg & 1 = 1 then
+            raise exception 'LZ4 frames with a dictionary ID are not supported.';
+        end if;
+        _pos := _pos + 2  -- FLG + BD
+            + case when _flg & 8 = 8 then 8 else 0 end  -- Content Size
+            + 1;  -- Header Checksum, which we don't verify
+
+        loop
+            _block_size := get_byte(lz4_frame$, _pos)::bigint
+                | get_byte(lz4_frame$, _pos + 1)::bigint << 8
+                | get_byte(lz4_frame$, _pos + 2)::bigint << 16
+                | get_byte(lz4_frame$, _pos + 3)::bigint << 24;
+            _pos := _pos + 4;
+            exit when _block_size = 0;  -- EndMark
+
+            if _block_size & x'80000000'::bigint != 0 then
+                -- Uncompressed block
+                _block_size := _block_size & x'7FFFFFFF'::bigint;
+                for _i in 0 .. _block_size - 1 loop
+                    _out_len := _out_len + 1;
+                    _out[_out_len] := get_byte(lz4_frame$, _pos + _i);
+                end loop;
+                _pos := _pos + _block_size;
+            else
+                _block_end := _pos + _block_size;
+                while _pos < _block_end loop
+                    _token := get_byte(lz4_frame$, _pos);
+                    _pos := _pos + 1;
+
+                    _literal_len := _token >> 4;
+                    if _literal_len = 15 then
+                        loop
+                            _len_byte := get_byte(lz4_frame$, _pos);
+                            _pos := _pos + 1;
+                            _literal_len := _literal_len + _len_byte;
+                            exit when _len_byte != 255;
+                        end loop;
+                    end if;
+                    for _i in 0 .. _literal_len - 1 loop
+                        _out_len := _out_len + 1;
+                        _out[_out_len] := get_byte(lz4_frame$, _pos + _i);
+                    end loop;
+                    _pos := _pos + _literal_len;
+
+                    exit when _pos >= _block_end;  -- The last sequence of a block has no match.
+
+                    _match_offset := get_byte(lz4_frame$, _pos) | get_byte(lz4_frame$, _pos + 1) << 8;
+                    _pos := _pos + 2;
+                    if _match_offset = 0 or _match_offset > _out_len then
+                        raise exception 'Corrupt LZ4 block: match offset % at byte % is out of range.',
+                            _match_offset, _pos - 2;
+                    end if;
+
+                    _match_len := (_token & 15) + 4;
+                    if _token & 15 = 15 then
+                        loop
+                            _len_byte := get_byte(lz4_frame$, _pos);
+                            _pos := _pos + 1;
+                            _match_len := _match_len + _len_byte;
+                            exit when _len_byte != 255;
+                        end loop;
+                    end if;
+                    -- Byte by byte, because the match may overlap with the bytes that it produces.
+                    for _i in 1 .. _match_len loop
+                        _out_len := _out_len + 1;
+                        _out[_out_len] := _out[_out_len - _match_offset];
+                    end loop;
+                end loop;
+            end if;
+
+            if _flg & 16 = 16 then
+                _pos := _pos + 4;  -- Block Checksum, which we don't verify
+            end if;
+        end loop;
+
+        if _flg & 4 = 4 then
+            _pos := _pos + 4;  -- Content Checksum, which we don't verify
+        end if;
+    end loop;
+
+    return coalesce(
+        (
+            select
+                decode(string_agg(lpad(to_hex(b), 2, '0'), '' order by i), 'hex')
+            from
+                unnest(_out) with ordinality as out_byte(b, i)
+        )
+        ,''::bytea
+    );
+end;
+$$;
+
+comment on function lz4_frame_decompress(bytea) is
+$md$Decompress a `bytea` in the [LZ4 frame format](https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md), as compressed by `pg_cmdqd` for queues with `queue_output_codec = 'lz4'`, or by the `lz4` command-line utility.
+
+Concatenated and skippable frames are supported; frames that depend on a
+dictionary are not.  Checksums are skipped over, not verified.
+
+This function is written in PL/pgSQL, so that it doesn't need an extension
+written in C.  That makes it slow: it is meant for inspecting the output of
+individual commands, not for decompressing large amounts of output in bulk.
+$md$;
+
+--------------------------------------------------------------------------------------------------------------
+
+create procedure test__lz4_frame_decompress()
+    set search_path from current
+    set plpgsql.check_asserts to true
+    language plpgsql
+    as $$
+declare
+    _expected bytea := convert_to(
+        'cmd_stdout: '
+        || (select string_agg(format(E'line %s of the output of a command that repeats itself\n', i % 3), '')
+            from generate_series(1, 20) as i)
+        || repeat('a', 300)
+        ,'UTF-8'
+    );
+begin
+    assert lz4_frame_decompress('\x04224d1860707300000000') = ''::bytea;
+
+    -- An uncompressed block, because compression wouldn't make the output smaller.
+    assert lz4_frame_decompress('\x04224d186070730d00008048656c6c6f2c20776f726c642100000000')
+        = convert_to('Hello, world!', 'UTF-8');
+
+    -- As compressed by `pg_cmdqd`, with a long, overlapping match at the end.
+    assert lz4_frame_decompress(
+        '\x04224d1860707366000000f011636d645f7374646f75743a206c696e652031206f6620746865206f7574707574'
+        '0e00f10f6120636f6d6d616e642074686174207265706561747320697473656c660a3600103228000f36001e1f'
+        '303600220fa200ffffff811f610100ff1450616161616100000000'
+    ) = _expected;
+
+    -- As compressed by `lz4 -c -BD -BX --content-size`, with a content size, block checksums, a content
+    -- checksum, and block dependency.
+    assert lz4_frame_decompress(
+        '\x04224d187c407005000000000000ca66000000f011636d645f7374646f75743a206c696e652031206f66207468'
+        '65206f75747075740e00f10f6120636f6d6d616e642074686174207265706561747320697473656c660a360010'
+        '3228000f36001e1f303600220fa200ffffff811f610100ff14506161616161d70c09ef00000000f8f0ebb3'
+    ) = _expected;
+
+    -- Two concatenated frames, with a skippable frame in between.
+    assert lz4_frame_decompress(
+        '\x04224d186070730d00008048656c6c6f2c20776f726c642100000000'
+        '502a4d180300000001020304224d186070730d00008048656c6c6f2c20776f726c642100000000'
+    ) = convert_to('Hello, world!Hello, world!', 'UTF-8');
+
+    begin
+        perform lz4_frame_decompress(convert_to('Hello, world!', 'UTF-8'));
+        raise assert_failure using message = 'Decompressing a non-LZ4 `bytea` should have failed.';
+    exception
+        when raise_exception then
+    end;
+end;
+$$;
+
+--------------------------------------------------------------------------------------------------------------
+
+create function cmd_output_decoded(cmd_output$ bytea, cmd_class$ regclass)
+    returns bytea
+    stable
+    parallel safe
+    set search_path from current
+    language sql
+    return case (select queue_output_codec from cmd_queue where cmd_class = cmd_class$)
+        when 'lz4' then
+            lz4_frame_decompress(cmd_output$)
+        else
+            cmd_output$
+    end;
+
+comment on function cmd_output_decoded(bytea, regclass) is
+$md$The `cmd_stdout` or `cmd_stderr` of a command in the given queue, decompressed according to that queue's `queue_output_codec`.
+
+Mind that, when the `queue_output_codec` of a queue is changed, the output of
+commands that ran before that change will no longer be decoded correctly.
+$md$;
+
+--------------------------------------------------------------------------------------------------------------
+
 create type sql_status_type as enum (
     'PGRES_EMPTY_QUERY'
     ,'PGRES_COMMAND_OK'
@@ -1700,15 +2471,27 @@ create type sql_status_type as enum (
     --,'PGRES_NONFATAL_ERROR'  -- only relevant for notices
     ,'PGRES_FATAL_ERROR'
     --,'PGRES_COPY_BOTH'  -- irrelevant to pg_cmd_queue
-    --,'PGRES_SINGLE_TUPLE'  -- commented out, because we do not support single row mode
+    --,'PGRES_SINGLE_TUPLE'  -- only ever the status of an intermediate result in single-row mode
     --,'PGRES_PIPELINE_SYNC'  -- pg_cmd_queue_daemon doesn't use libpq's pipeline mode
     --,'PGRES_PIPELINE_ABORTED'  -- pg_cmd_queue_daemon doesn't use libpq's pipeline mode
+    ,'CMDQD_TIMEOUT'
+    ,'CMDQD_CANCELED'
 );
 
 comment on type sql_status_type is
 $md$The possible SQL command result statuses.
 
-[`PQresultStatus()`](https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQRESULTSTATUS)
+Apart from the `PGRES_*` statuses that are returned by libpq's
+[`PQresultStatus()`](https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQRESULTSTATUS),
+there are two statuses that are specific to `pg_cmdqd`:
+
+* `CMDQD_TIMEOUT` means that `pg_cmdqd` canceled the `cmd_sql`, because it ran
+  for longer than the `queue_cmd_timeout` of the queue.
+* `CMDQD_CANCELED` means that `pg_cmdqd` canceled the `cmd_sql`, because it was
+  asked to stop (with a `SIGTERM`, for instance) while the command was running.
+
+In both cases, the `cmd_sql_fatal_error` holds the `query_canceled` error
+(SQLSTATE `57014`) as it was reported by the server.
 $md$;
 
 --------------------------------------------------------------------------------------------------------------
@@ -1750,6 +2533,7 @@ create table sql_queue_cmd_template (
        including all
     ,cmd_sql text
         not null
+    ,cmd_sql_params text[]
     ,cmd_sql_result_status sql_status_type
     ,cmd_sql_fatal_error sql_errorish
     ,cmd_sql_nonfatal_errors sql_errorish[]
@@ -1757,11 +2541,37 @@ create table sql_queue_cmd_template (
 );
 
 
+comment on column sql_queue_cmd_template.cmd_sql_params is
+$md$The values for the `$1`, `$2`, etc. parameter placeholders in `cmd_sql`.
+
+When `cmd_sql_params` is `NULL` (the default), `cmd_sql` is sent to the server
+as-is, and it may consist of multiple statements.  When `cmd_sql_params` is
+_not_ `NULL` (even if it's an empty array), `cmd_sql` must be a single statement,
+which `pg_cmdqd` `PREPARE`s once per connection and then executes with the
+`cmd_sql_params` of each command (see `queue_cmd_sql_cache_size`).  The
+parameter types are inferred from `cmd_sql`; add casts (like `$1::int`) where
+the server cannot infer them.
+
+This saves the server from having to parse and plan the same statement over and
+over again, and it saves producers from having to interpolate (and quote!)
+values into `cmd_sql`.
+
+The `run_sql_cmd_queue()` procedure does not support `cmd_sql_params`.
+$md$;
+
 comment on column sql_queue_cmd_template.cmd_sql_result_rows is
 $md$The result rows represented as a JSON array of objects.
 
-When `cmd_sql` produced no rows, `cmd_sql` will contain either an SQL `NULL` or
-JSON `'null'` value.
+When `cmd_sql` is a query that returned no rows, this is an empty JSON array.
+When `cmd_sql` returned no result set at all (because it was an `UPDATE`
+without `RETURNING` clause, for instance) or failed, this is an SQL `NULL`.
+When `cmd_sql` consists of multiple statements, the rows of all the statements
+end up in the same array.
+
+`pg_cmdqd` turns numbers, booleans, `json` and `jsonb` into their JSON
+counterparts, and every other value into a JSON string of its text
+representation.  See `queue_max_result_rows` and `queue_max_result_bytes` on how
+to cap the size of this column.
 $md$;
 
 
@@ -1829,6 +2639,48 @@ select
     ,q.queue_reselect_randomized_every_nth
     ,extract('epoch' from q.queue_select_timeout) as queue_select_timeout_sec
     ,extract('epoch' from q.queue_cmd_timeout) AS queue_cmd_timeout_sec
+    ,q.queue_worker_argv
+    ,q.queue_worker_max_cmds
+    ,q.queue_output_codec
+    ,q.queue_max_stdout_bytes
+    ,q.queue_max_stderr_bytes
+    ,q.queue_output_capture
+    ,case
+        when (
+            select
+                count(*)
+            from
+                pg_catalog.pg_attribute
+            where
+                attrelid = q.cmd_class
+                and attname in ('cmd_stdout_blob', 'cmd_stderr_blob')
+                and not attisdropped
+        ) = 2
+        then q.queue_output_spill_dir
+    end as queue_output_spill_dir
+    ,q.queue_output_spill_threshold_bytes
+    ,q.queue_rlimit_as_bytes
+    ,ceil(extract('epoch' from q.queue_rlimit_cpu))::int as queue_rlimit_cpu_sec
+    ,q.queue_rlimit_nofile
+    ,q.queue_cmd_nice
+    ,q.queue_cmd_ioprio_class
+    ,q.queue_cmd_ioprio_level
+    ,q.queue_cpu_set
+    ,q.queue_sched_policy
+    ,q.queue_max_result_rows
+    ,q.queue_max_result_bytes
+    ,q.queue_cmd_sql_cache_size
+    ,case
+        when q.cmd_signature_class = 'cmdq.sql_queue_cmd_template'::regclass
+        then q.queue_group_commit_max_cmds
+        else 1
+    end as queue_group_commit_max_cmds
+    ,extract('epoch' from q.queue_group_commit_max_latency) * 10^3 as queue_group_commit_max_latency_msec
+    ,case
+        when q.cmd_signature_class = 'cmdq.sql_queue_cmd_template'::regclass
+        then q.queue_parallel_cmds
+        else 1
+    end as queue_parallel_cmds
     ,q.queue_metadata_updated_at
     ,color.ansi_fg
 from
@@ -1866,13 +2718,14 @@ create function cmdqd.select_cmd_from_queue_stmt(
     ] AS cmd_class_relname
     ,cmd_id
     ,cmd_subid
-    ,extract(epoch from cmd_queued_since) AS cmd_queued_since' || case
+    ,extract(epoch from cmd_queued_since)::float8 AS cmd_queued_since' || case
 when ($1).cmd_signature_class = 'cmdq.sql_queue_cmd_template'::regclass then '
-    ,cmd_sql'
+    ,cmd_sql
+    ,cmd_sql_params'
 when ($1).cmd_signature_class = 'cmdq.nix_queue_cmd_template'::regclass then '
     ,cmd_argv
     ,cmd_env
-    ,convert_from(cmd_stdin, ''UTF8'') AS cmd_stdin'  -- FIXME: We shouldn't assume text, let alone UTF-8.
+    ,cmd_stdin'
 when ($1).cmd_signature_class = 'cmdq.http_queue_cmd_template'::regclass then '
     ,cmd_http_url text
     ,cmd_http_version text
@@ -1922,7 +2775,7 @@ $$;
 
 create function cmdqd.update_cmd_in_queue_stmt(cmdqd.cmd_queue)
     returns text
-    immutable
+    stable
     leakproof
     parallel safe
     language sql
@@ -1941,7 +2794,27 @@ when ($1).cmd_signature_class = 'cmdq.nix_queue_cmd_template'::regclass then '
         ,cmd_exit_code = $5
         ,cmd_term_sig = $6
         ,cmd_stdout = $7
-        ,cmd_stderr = $8'
+        ,cmd_stderr = $8' || case when exists (
+            select from pg_catalog.pg_attribute
+            where attrelid = ($1).cmd_class and attname = 'cmd_rusage' and not attisdropped
+        ) then '
+        ,cmd_rusage = $9' else '' end || case when exists (
+            select from pg_catalog.pg_attribute
+            where attrelid = ($1).cmd_class and attname = 'cmd_stdout_bytes' and not attisdropped
+        ) then '
+        ,cmd_stdout_bytes = $10' else '' end || case when exists (
+            select from pg_catalog.pg_attribute
+            where attrelid = ($1).cmd_class and attname = 'cmd_stderr_bytes' and not attisdropped
+        ) then '
+        ,cmd_stderr_bytes = $11' else '' end || case when exists (
+            select from pg_catalog.pg_attribute
+            where attrelid = ($1).cmd_class and attname = 'cmd_stdout_blob' and not attisdropped
+        ) then '
+        ,cmd_stdout_blob = $12' else '' end || case when exists (
+            select from pg_catalog.pg_attribute
+            where attrelid = ($1).cmd_class and attname = 'cmd_stderr_blob' and not attisdropped
+        ) then '
+        ,cmd_stderr_blob = $13' else '' end
 when ($1).cmd_signature_class = 'cmdq.http_queue_cmd_template'::regclass then '
         ,cmd_http_response_headers = $5
         ,cmd_http_response_body = $6' end || '
@@ -1966,11 +2839,33 @@ ON CONFLICT (cmd_id, cmd_subid) DO NOTHING
 
 --------------------------------------------------------------------------------------------------------------
 
+create function cmdqd.update_cmd_in_queue_param_types(cmdqd.cmd_queue)
+    returns text
+    immutable
+    leakproof
+    parallel safe
+    language sql
+    return case
+when ($1).cmd_signature_class = 'cmdq.nix_queue_cmd_template'::regclass then
+    -- `$9` to `$13` are only referenced when the queue has the optional `cmd_rusage`, `cmd_stdout_bytes`,
+    -- `cmd_stderr_bytes`, `cmd_stdout_blob` and `cmd_stderr_blob` columns, so their types cannot always be
+    -- inferred from the statement.
+    'text, text, float8, float8, int, int, bytea, bytea, cmdq.nix_cmd_rusage, bigint, bigint'
+    || ', cmdq.cmd_output_blob, cmdq.cmd_output_blob'
+end;
+
+comment on function cmdqd.update_cmd_in_queue_param_types(cmdqd.cmd_queue) is
+$md$The parameter types with which the `update_cmd` statement is `PREPARE`d, or `NULL` to let Postgres infer them.
+$md$;
+
+--------------------------------------------------------------------------------------------------------------
+
 create procedure cmdqd.prepare_to_update_cmd_in_queue(cmdqd.cmd_queue)
     language plpgsql
     as $$
 begin
-    execute 'PREPARE update_cmd AS ' || cmdqd.update_cmd_in_queue_stmt($1);
+    execute 'PREPARE update_cmd' || coalesce(' (' || cmdqd.update_cmd_in_queue_param_types($1) || ')', '')
+        || ' AS ' || cmdqd.update_cmd_in_queue_stmt($1);
 end;
 $$;
 
@@ -1982,8 +2877,7 @@ create procedure cmdqd.runner_session_start(cmdqd.cmd_queue, "pg_cmdqd_env$" hst
     as $$
 begin
     if ($1).queue_runner_role is not null then
-        -- TODO
-        --execute format('SET SESSION ROLE %I', ($1).queue_runner_role);
+        execute format('SET SESSION ROLE %I', ($1).queue_runner_role);
     end if;
 
     perform set_config('pg_cmd_queue.runner.reselect_round', '0', false);
@@ -2589,6 +3483,23 @@ begin
     if _actual.cmd_stderr is distinct from expect$.cmd_stderr then
         _errors := _errors || format(E'cmd_stderr = %L\n≠ %L', convert_from(_actual.cmd_stderr, 'UTF8'), convert_from(expect$.cmd_stderr, 'UTF8'));
     end if;
+    if to_jsonb(_actual) ? 'cmd_rusage' and to_jsonb(_actual)->'cmd_rusage' = 'null'::jsonb then
+        _errors := _errors || '`cmd_rusage` was not recorded.'::text;
+    end if;
+    if to_jsonb(_actual) ? 'cmd_stdout_bytes'
+        and (to_jsonb(_actual)->>'cmd_stdout_bytes')::bigint is distinct from length(_actual.cmd_stdout)
+    then
+        _errors := _errors || format(
+            'cmd_stdout_bytes = %s ≠ %s', to_jsonb(_actual)->>'cmd_stdout_bytes', length(_actual.cmd_stdout)
+        );
+    end if;
+    if to_jsonb(_actual) ? 'cmd_stderr_bytes'
+        and (to_jsonb(_actual)->>'cmd_stderr_bytes')::bigint is distinct from length(_actual.cmd_stderr)
+    then
+        _errors := _errors || format(
+            'cmd_stderr_bytes = %s ≠ %s', to_jsonb(_actual)->>'cmd_stderr_bytes', length(_actual.cmd_stderr)
+        );
+    end if;
 
     if array_length(_errors, 1) > 0 then
         raise assert_failure using
@@ -2630,6 +3541,11 @@ begin
         create table tst_nix_cmd (
             like nix_queue_cmd_template
                 including all
+            ,cmd_rusage nix_cmd_rusage
+            ,cmd_stdout_bytes bigint
+            ,cmd_stderr_bytes bigint
+            ,cmd_stdout_blob cmd_output_blob
+            ,cmd_stderr_blob cmd_output_blob
         );
         alter table tst_nix_cmd
             alter column cmd_class set default 'tst_nix_cmd';
@@ -3122,6 +4038,10 @@ begin
                 message = format('Executing %s', _cmd_queue.cmd_class)
                 ,detail = jsonb_pretty(to_jsonb(_sql_queue_cmd));
             _cmd_sql_result_rows := null::jsonb;
+            if _sql_queue_cmd.cmd_sql_params is not null then
+                raise feature_not_supported using
+                    message = '`run_sql_cmd_queue()` does not support `cmd_sql_params`; use `pg_cmdqd`.';
+            end if;
             for _cmd_sql_result_row in execute _sql_queue_cmd.cmd_sql loop
                 _cmd_sql_result_rows := coalesce(
                     _cmd_sql_result_rows || to_jsonb(array[to_jsonb(_cmd_sql_result_row)])
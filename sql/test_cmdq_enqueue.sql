@@ -0,0 +1,73 @@
+\set ECHO none
+-- Enqueues commands through `pg_cmdq_enqueue`, which `COPY`s them in binary format, and reads them back.
+set client_min_messages to warning;
+
+create extension pg_cmd_queue cascade;
+
+create table cmdq.tst_enqueue_nix_cmd (
+    like cmdq.nix_queue_cmd_template
+        including all
+);
+create table cmdq.tst_enqueue_sql_cmd (
+    like cmdq.sql_queue_cmd_template
+        including all
+);
+
+-- With `pg_cmd_queue.coalesce_notify` on, this fires a payload without `cmd_id` for every `COPY`ed row.
+create trigger notify
+    after insert
+    on cmdq.tst_enqueue_nix_cmd
+    for each row
+    execute function cmdq.queue_cmd__notify('tst_enqueue_nix_cmd');
+
+-- Disabled, so that the `pg_cmdqd` that `pg_regress` was launched with leaves the commands alone.
+insert into cmdq.cmd_queue (
+    cmd_class
+    ,cmd_signature_class
+    ,queue_is_enabled
+)
+values (
+    'cmdq.tst_enqueue_nix_cmd'
+    ,'cmdq.nix_queue_cmd_template'
+    ,false
+)
+,(
+    'cmdq.tst_enqueue_sql_cmd'
+    ,'cmdq.sql_queue_cmd_template'
+    ,false
+);
+
+-- `pg_cmdq_enqueue` takes its connection parameters from the environment.
+\setenv PGDATABASE :DBNAME
+
+-- A batch size of 2 makes the 3 commands span 2 `COPY`s.
+\! printf 'argv-only\t\\N\t{echo,hello}\nenv-with-null\tsub-1\t{env,"with space"}\t"A"=>"1", "B"=>NULL\thi\nempty-stdin\t\\N\t{cat}\t\t\n' | pg_cmdq_enqueue --batch-size 2 cmdq.tst_enqueue_nix_cmd
+
+\! printf 'no-params\t\\N\tselect 1\nparams\t\\N\tselect $1::int + $2::int\t{1,2}\nparams-with-null\t\\N\tselect coalesce($1, $2)\t{NULL,x}\nempty-params\t\\N\tselect now()\t{}\n' | pg_cmdq_enqueue cmdq.tst_enqueue_sql_cmd
+
+select
+    cmd_class
+    ,cmd_id
+    ,cmd_subid
+    ,cmd_argv
+    ,cmd_env
+    ,convert_from(cmd_stdin, 'UTF8') as cmd_stdin
+from
+    cmdq.tst_enqueue_nix_cmd
+order by
+    cmd_id
+;
+
+select
+    cmd_class
+    ,cmd_id
+    ,cmd_subid
+    ,cmd_sql
+    ,cmd_sql_params
+from
+    cmdq.tst_enqueue_sql_cmd
+order by
+    cmd_id
+;
+
+drop extension pg_cmd_queue cascade;